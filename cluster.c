@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "cluster.h"
+#include "transfer.h"
+#include "protocol.h"
+
+// Function to resolve a slave's host and port (hostname, IPv4 or IPv6)
+int cluster_resolve(SlaveInfo *s)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", s->port);
+
+    int rc = getaddrinfo(s->host, port_str, &hints, &res);
+    if (rc != 0)
+    {
+        fprintf(stderr, "Cannot resolve %s: %s\n", s->host, gai_strerror(rc));
+        return -1;
+    }
+
+    memcpy(&s->addr, res->ai_addr, res->ai_addrlen);
+    s->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// Function to append a slave to the registry, growing it when full
+static SlaveInfo *add_slave(Cluster *c)
+{
+    if (c->num_slaves == c->capacity)
+    {
+        int capacity = c->capacity ? c->capacity * 2 : 32;
+        SlaveInfo *grown = (SlaveInfo *)realloc(c->slaves, capacity * sizeof(SlaveInfo));
+        if (grown == NULL)
+        {
+            perror("Slave registry allocation failed");
+            return NULL;
+        }
+        c->slaves = grown;
+        c->capacity = capacity;
+    }
+    return &c->slaves[c->num_slaves++];
+}
+
+// Function to read the configuration file
+int cluster_load(Cluster *c, const char *path, int is_slave, Options *opts)
+{
+    memset(c, 0, sizeof(*c));
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        perror("Error opening config file");
+        return -1;
+    }
+
+    char line[1024];
+    int line_no = 0;
+    int rc = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        line_no++;
+
+        // Split the line into whitespace separated fields
+        char *fields[6];
+        int num_fields = 0;
+        char *save = NULL;
+        for (char *tok = strtok_r(line, " \t\r\n", &save); tok != NULL && num_fields < 6;
+             tok = strtok_r(NULL, " \t\r\n", &save))
+        {
+            fields[num_fields++] = tok;
+        }
+
+        // Skip comments and empty lines
+        if (num_fields == 0 || fields[0][0] == '#')
+            continue;
+
+        if (num_fields == 2) // "key value" option
+        {
+            if (options_set(opts, fields[0], fields[1]) != 0)
+                rc = -1;
+            continue;
+        }
+
+        if (num_fields < 3 || num_fields > 5 || strlen(fields[0]) >= MAX_HOST_LEN)
+        {
+            fprintf(stderr, "%s:%d: expected \"host port role [weight [streams]]\"\n", path, line_no);
+            rc = -1;
+            continue;
+        }
+
+        char *end;
+        long port = strtol(fields[1], &end, 10);
+        if (*end != '\0' || port <= 0 || port > 65535)
+        {
+            fprintf(stderr, "%s:%d: invalid port %s\n", path, line_no, fields[1]);
+            rc = -1;
+            continue;
+        }
+
+        if (strcmp(fields[2], "master") == 0)
+        {
+            strcpy(c->master_host, fields[0]);
+        }
+        else if (strcmp(fields[2], "slave") == 0)
+        {
+            double weight = 1.0;
+            long streams = 0;
+            if (num_fields >= 4)
+            {
+                weight = strtod(fields[3], &end);
+                if (*end != '\0' || !(weight > 0))
+                {
+                    fprintf(stderr, "%s:%d: invalid weight %s\n", path, line_no, fields[3]);
+                    rc = -1;
+                    continue;
+                }
+            }
+            if (num_fields == 5)
+            {
+                streams = strtol(fields[4], &end, 10);
+                if (*end != '\0' || streams < 1 || streams > PROTO_MAX_STREAMS)
+                {
+                    fprintf(stderr, "%s:%d: invalid streams %s (1 to %d)\n", path, line_no, fields[4], PROTO_MAX_STREAMS);
+                    rc = -1;
+                    continue;
+                }
+            }
+
+            SlaveInfo *s = add_slave(c);
+            if (s == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            memset(s, 0, sizeof(*s));
+            strcpy(s->host, fields[0]);
+            s->port = (int)port;
+            s->weight = weight;
+            s->streams = (int)streams;
+            if (!is_slave && cluster_resolve(s) != 0) // slaves resolve a peer only when they relay to it
+                rc = -1;
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown role %s\n", path, line_no, fields[2]);
+            rc = -1;
+        }
+    }
+
+    fclose(fp);
+    if (rc != 0)
+        cluster_free(c);
+    return rc;
+}
+
+// Function to find a slave's index among the slaves listed on the same host
+int cluster_local_slot(const Cluster *c, int port)
+{
+    for (int i = 0; i < c->num_slaves; i++)
+    {
+        if (c->slaves[i].port != port)
+            continue;
+        int slot = 0;
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(c->slaves[j].host, c->slaves[i].host) == 0)
+                slot++;
+        }
+        return slot;
+    }
+    return 0;
+}
+
+// Function to release the slave registry
+void cluster_free(Cluster *c)
+{
+    free(c->slaves);
+    c->slaves = NULL;
+    c->num_slaves = 0;
+    c->capacity = 0;
+}
+
+// Function to connect to a slave
+int cluster_connect(const SlaveInfo *slave, int nonblocking)
+{
+    // Create socket of the slave's address family (IPv4 or IPv6)
+    int sock = socket(slave->addr.ss_family, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (sock < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+    transfer_tune(sock); // buffer sizes only count when set before the handshake
+
+    // Connect to server
+    if (connect(sock, (const struct sockaddr *)&slave->addr, slave->addr_len) < 0 &&
+        !(nonblocking && errno == EINPROGRESS))
+    {
+        perror("Connection failed");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
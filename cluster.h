@@ -0,0 +1,53 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <sys/socket.h>
+#include "options.h"
+
+#define MAX_HOST_LEN 256 // hostname or IP address length
+
+// Structure to store slave information
+typedef struct
+{
+    char host[MAX_HOST_LEN];      // hostname, IPv4 or IPv6 address as written in the config
+    int port;                     // port number
+    double weight;                // relative capacity of the slave (1 by default)
+    int streams;                  // TCP streams the master stripes its blocks over, 0 = the streams option
+    struct sockaddr_storage addr; // resolved address
+    socklen_t addr_len;
+} SlaveInfo;
+
+// Registry of the nodes listed in the config file
+typedef struct
+{
+    char master_host[MAX_HOST_LEN]; // master address ("" if none listed)
+    SlaveInfo *slaves;              // growable array of slaves
+    int num_slaves;
+    int capacity;
+} Cluster;
+
+// Function to read the configuration file, in a single pass
+// Node lines are "host port role [weight [streams]]", where role is master or slave
+// Lines with two fields are "key value" options and are stored in opts
+// Slave addresses are only resolved when !is_slave
+// Returns 0 on success, -1 on error
+int cluster_load(Cluster *c, const char *path, int is_slave, Options *opts);
+
+// Function to find the index of the slave listening on port among the
+// slaves listed with the same host, so co-located slaves use different CPUs
+// Returns 0 when no slave has that port
+int cluster_local_slot(const Cluster *c, int port);
+
+// Function to resolve a slave's host and port into addr
+// Returns 0 on success, -1 on error
+int cluster_resolve(SlaveInfo *s);
+
+// Releases the slave registry
+void cluster_free(Cluster *c);
+
+// Function to connect to a slave
+// With nonblocking, the connection may still be in progress when this returns
+// Returns the socket, or -1 on failure
+int cluster_connect(const SlaveInfo *slave, int nonblocking);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "transfer.h"
+#include "protocol.h"
+#include "connpool.h"
+
+// Function to get the seconds elapsed since t0
+static double seconds_since(const struct timespec *t0)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) / 1000000000.0;
+}
+
+// Function to set up a pool with no connection open
+int connpool_init(ConnPool *p, const SlaveInfo slaves[], int num_slaves, int streams)
+{
+    memset(p, 0, sizeof(*p));
+    p->slaves = slaves;
+    p->num_slaves = num_slaves;
+    p->fds = (int *)malloc((num_slaves + 1) * sizeof(int));
+    p->streams = (int *)malloc((num_slaves + 1) * sizeof(int));
+    p->extra = (int *)malloc(((size_t)num_slaves * PROTO_MAX_STREAMS + 1) * sizeof(int));
+    p->connects = (int *)calloc(num_slaves + 1, sizeof(int));
+    p->connect_time = (double *)calloc(num_slaves + 1, sizeof(double));
+    if (p->fds == NULL || p->streams == NULL || p->extra == NULL || p->connects == NULL || p->connect_time == NULL)
+    {
+        perror("Connection pool allocation failed");
+        connpool_free(p);
+        return -1;
+    }
+    for (int s = 0; s < num_slaves; s++)
+    {
+        p->fds[s] = -1;
+        p->streams[s] = (streams <= 0) ? 1 : (slaves[s].streams > 0) ? slaves[s].streams : streams;
+        if (p->streams[s] > PROTO_MAX_STREAMS)
+            p->streams[s] = PROTO_MAX_STREAMS;
+    }
+    for (int e = 0; e < num_slaves * PROTO_MAX_STREAMS; e++)
+        p->extra[e] = -1;
+    return 0;
+}
+
+// Function to get where the socket of stream k of slave s is kept
+static int *stream_fd(const ConnPool *p, int s, int k)
+{
+    return (k == 0) ? &p->fds[s] : &p->extra[s * PROTO_MAX_STREAMS + k];
+}
+
+// Function to make a freshly connected socket blocking
+// (cluster_connect already applied the socket profile)
+static void connpool_ready(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+}
+
+// Function to check the open connections and open the missing ones in parallel
+int connpool_prepare(ConnPool *p)
+{
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    p->opened = 0;
+    p->reused = 0;
+    p->failed = 0;
+
+    // One entry per stream, stream k of slave s at s * PROTO_MAX_STREAMS + k
+    int entries = p->num_slaves * PROTO_MAX_STREAMS;
+    struct pollfd *pfds = (struct pollfd *)malloc((entries + 1) * sizeof(struct pollfd));
+    if (pfds == NULL)
+    {
+        perror("Connection pool allocation failed");
+        return 0;
+    }
+
+    // A slave never sends anything between jobs, so an idle connection
+    // that polls readable has been closed or reset by its slave
+    int pending = 0;
+    for (int e = 0; e < entries; e++)
+    {
+        int s = e / PROTO_MAX_STREAMS, k = e % PROTO_MAX_STREAMS;
+        int *fd = stream_fd(p, s, k);
+        pfds[e].fd = -1; // ignored by poll
+        pfds[e].events = POLLOUT;
+        pfds[e].revents = 0;
+        if (k >= p->streams[s])
+            continue;
+        if (*fd >= 0)
+        {
+            struct pollfd idle = {*fd, POLLIN, 0};
+            transfer_reap_zerocopy(*fd); // late completions would poll as an error
+            if (poll(&idle, 1, 0) == 0)
+            {
+                p->reused++;
+                continue;
+            }
+            close(*fd);
+            *fd = -1;
+        }
+
+        // Start the handshake; it completes when the socket turns writable
+        pfds[e].fd = cluster_connect(&p->slaves[s], 1);
+        if (pfds[e].fd < 0)
+            p->failed++;
+        else
+            pending++;
+    }
+
+    while (pending > 0)
+    {
+        int left = CONNPOOL_TIMEOUT_MS - (int)(seconds_since(&t0) * 1000);
+        int ready = (left > 0) ? poll(pfds, entries, left) : 0;
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            break;
+
+        for (int e = 0; e < entries; e++)
+        {
+            if (pfds[e].fd < 0 || pfds[e].revents == 0)
+                continue;
+            int s = e / PROTO_MAX_STREAMS, k = e % PROTO_MAX_STREAMS;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(pfds[e].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0)
+            {
+                // An extra stream tells the slave what it is before anything else
+                connpool_ready(pfds[e].fd);
+                if (k > 0 && proto_send_stream(pfds[e].fd, (uint32_t)k, (uint32_t)p->streams[s], NULL) != 0)
+                    err = errno;
+            }
+            if (err != 0)
+            {
+                fprintf(stderr, "Slave %d (%s:%d): Connection failed: %s\n", s, p->slaves[s].host,
+                        p->slaves[s].port, strerror(err));
+                close(pfds[e].fd);
+                p->failed++;
+            }
+            else
+            {
+                *stream_fd(p, s, k) = pfds[e].fd;
+                p->connects[s]++;
+                p->connect_time[s] += seconds_since(&t0);
+                p->opened++;
+            }
+            pfds[e].fd = -1;
+            pending--;
+        }
+    }
+
+    // Handshakes still in progress have timed out
+    for (int e = 0; e < entries; e++)
+    {
+        if (pfds[e].fd < 0)
+            continue;
+        int s = e / PROTO_MAX_STREAMS;
+        fprintf(stderr, "Slave %d (%s:%d): Connection timed out after %d ms\n", s, p->slaves[s].host,
+                p->slaves[s].port, CONNPOOL_TIMEOUT_MS);
+        close(pfds[e].fd);
+        p->failed++;
+    }
+    free(pfds);
+
+    int connected = 0;
+    for (int s = 0; s < p->num_slaves; s++)
+        connected += (p->fds[s] >= 0);
+    p->last_time = seconds_since(&t0);
+    return connected;
+}
+
+// Function to get the open streams to a slave
+int connpool_streams(const ConnPool *p, int s, int *fds)
+{
+    if (p->fds[s] < 0)
+        return 0;
+    int count = 0;
+    for (int k = 0; k < p->streams[s]; k++)
+    {
+        int fd = *stream_fd(p, s, k);
+        if (fd >= 0)
+            fds[count++] = fd;
+    }
+    return count;
+}
+
+// Function to close the streams to a slave after an error
+void connpool_close(ConnPool *p, int s)
+{
+    for (int k = 0; k < p->streams[s]; k++)
+    {
+        int *fd = stream_fd(p, s, k);
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+// Function to close every connection
+void connpool_reset(ConnPool *p)
+{
+    for (int s = 0; p->fds != NULL && p->streams != NULL && p->extra != NULL && s < p->num_slaves; s++)
+        connpool_close(p, s);
+}
+
+// Function to print what the last prepare did
+void connpool_print_prepare(const ConnPool *p)
+{
+    printf("Connect time: %0.9f seconds (%d opened, %d reused, %d failed)\n", p->last_time, p->opened, p->reused,
+           p->failed);
+}
+
+// Function to print the connections opened to a slave
+void connpool_print(const ConnPool *p, int s, const char *label)
+{
+    printf("%s: ", label);
+    if (p->streams[s] > 1)
+        printf("%d streams, ", p->streams[s]);
+    printf("%d connections opened, %0.9f seconds in handshakes\n", p->connects[s], p->connect_time[s]);
+}
+
+// Function to close every connection and release the pool
+void connpool_free(ConnPool *p)
+{
+    connpool_reset(p);
+    free(p->fds);
+    free(p->streams);
+    free(p->extra);
+    free(p->connects);
+    free(p->connect_time);
+    p->fds = NULL;
+    p->streams = NULL;
+    p->extra = NULL;
+    p->connects = NULL;
+    p->connect_time = NULL;
+}
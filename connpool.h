@@ -0,0 +1,65 @@
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include "cluster.h"
+
+// Connections from the master to its slaves, kept open across jobs
+//
+// connpool_prepare opens every missing connection at once (non-blocking
+// connects with the socket profile, waited on together with one poll) and
+// replaces the open ones whose slave has hung up, so the handshakes are paid
+// before a job's timer starts rather than inside it, and a dead connection
+// is noticed before a job instead of failing in the middle of it
+// A slave may get several streams: its connection in fds, which carries the
+// blocks and their replies, and extra ones its blocks are striped over; an
+// extra stream announces itself to the slave as soon as it is connected
+// The sockets handed out are blocking; the event-driven master switches them
+// to non-blocking itself
+
+#define CONNPOOL_TIMEOUT_MS 5000 // longest wait for the handshakes of one prepare
+
+typedef struct
+{
+    const SlaveInfo *slaves;
+    int num_slaves;
+    int *fds;             // connection to each slave, -1 if none
+    int *streams;         // streams to each slave, the connection in fds included
+    int *extra;           // extra stream k (1 to streams - 1) of slave s at extra[s * PROTO_MAX_STREAMS + k], -1 if none
+    int *connects;        // connections opened to each slave over the run
+    double *connect_time; // time spent in the handshakes with each slave over the run
+    double last_time;     // wall time of the last prepare
+    int opened;           // connections opened by the last prepare
+    int reused;           // connections the last prepare found healthy
+    int failed;           // connections the last prepare could not open
+} ConnPool;
+
+// Sets up a pool with no connection open
+// streams is the number of streams to the slaves that do not set their own in
+// the config, 0 for a single stream to every slave whatever the config says
+// Returns 0 on success, -1 on error
+int connpool_init(ConnPool *p, const SlaveInfo slaves[], int num_slaves, int streams);
+
+// Function to check the open connections and open the missing ones in parallel
+// Returns the number of slaves connected
+int connpool_prepare(ConnPool *p);
+
+// Function to get the open streams to slave s, its connection first
+// Returns the number of streams stored in fds (up to PROTO_MAX_STREAMS), 0 if the slave is not connected
+int connpool_streams(const ConnPool *p, int s, int *fds);
+
+// Closes every stream to slave s after an error; the next prepare reopens them
+void connpool_close(ConnPool *p, int s);
+
+// Closes every connection, so the next prepare reopens them with the current socket profile
+void connpool_reset(ConnPool *p);
+
+// Prints what the last prepare did
+void connpool_print_prepare(const ConnPool *p);
+
+// Prints the connections opened to slave s, after its transfer counters
+void connpool_print(const ConnPool *p, int s, const char *label);
+
+// Closes every connection and releases the pool
+void connpool_free(ConnPool *p);
+
+#endif
@@ -0,0 +1,656 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "kernel.h"
+
+// Function to get the name of a kernel
+const char *kernel_name(KernelKind k)
+{
+    static const char *const names[] = {"none", "matvec", "rowsum", "colsum", "pearson"};
+    return (k >= KERNEL_NONE && k <= KERNEL_PEARSON) ? names[k] : "unknown";
+}
+
+// Function to describe the work for a block
+void kernel_task(KernelKind k, const MatrixBlock *blk, const int *vec, BlockTask *task)
+{
+    task->kernel = (uint32_t)k;
+    task->vec_len = kernel_vector_len(k, blk->num_rows, blk->num_cols);
+    task->vec = NULL;
+    task->seed = 0;
+    task->encoding = PROTO_ENC_RAW;
+    task->bcast = NULL;
+    task->bcast_len = 0;
+    task->rank = 0;
+    task->ranks = 0;
+    task->stripes = 0;
+    if (task->vec_len > 0)
+        task->vec = vec + kernel_vector_start(k, blk->row_start, blk->col_start);
+}
+
+// Function to make a task part of a broadcast of the vector
+uint32_t kernel_task_broadcast(BroadcastMode mode, const int *vec, int n, int rank, int size, BlockTask *task)
+{
+    if (mode == BROADCAST_DIRECT || task->vec_len == 0)
+        return 0;
+    task->bcast = vec;
+    task->bcast_len = n;
+    task->rank = (uint32_t)rank;
+    task->ranks = (uint32_t)size;
+    return (mode == BROADCAST_TREE) ? PROTO_FLAG_BCAST_TREE : PROTO_FLAG_BCAST_CHAIN;
+}
+
+// Function to make a task part of a reduce of the results
+uint32_t kernel_task_reduce(ReduceMode mode, int rank, int size, BlockTask *task)
+{
+    if (mode == REDUCE_DIRECT || task->kernel == KERNEL_NONE)
+        return 0;
+    task->rank = (uint32_t)rank;
+    task->ranks = (uint32_t)size;
+    return (mode == REDUCE_TREE) ? PROTO_FLAG_REDUCE_TREE : PROTO_FLAG_REDUCE_CHAIN;
+}
+
+// Function to get the number of results the master gets back for a block
+int kernel_reply_len(const BlockTask *task, uint32_t flags, const MatrixBlock *blk, int n)
+{
+    KernelKind k = (KernelKind)task->kernel;
+    if (flags & PROTO_FLAG_REDUCE)
+        return (task->rank == 0) ? kernel_result_len(k, n, n) : 0;
+    return kernel_result_len(k, blk->num_rows, blk->num_cols);
+}
+
+// Function to get where the slice of the vector a kernel needs starts
+int kernel_vector_start(KernelKind k, int start_row, int col_start)
+{
+    if (k == KERNEL_MATVEC)
+        return col_start;
+    if (k == KERNEL_PEARSON)
+        return start_row;
+    return 0;
+}
+
+// Function to get the vector length a kernel needs
+int kernel_vector_len(KernelKind k, int rows, int cols)
+{
+    if (k == KERNEL_MATVEC)
+        return cols;
+    if (k == KERNEL_PEARSON)
+        return rows;
+    return 0;
+}
+
+// Function to get the number of results a kernel produces
+int kernel_result_len(KernelKind k, int rows, int cols)
+{
+    switch (k)
+    {
+    case KERNEL_MATVEC:
+    case KERNEL_ROWSUM:
+        return rows;
+    case KERNEL_COLSUM:
+        return cols;
+    case KERNEL_PEARSON:
+        return 3 * cols;
+    default:
+        return 0;
+    }
+}
+
+// Row primitives the kernels are built from
+// Every product and sum is exact in 64 bits, whatever instruction set computes it
+typedef struct
+{
+    const char *name;
+    int64_t (*dot)(const int *a, const int *b, int len);                                    // sum a[j] * b[j]
+    int64_t (*sum)(const int *a, int len);                                                   // sum a[j]
+    void (*add)(int64_t *c, const int *a, int len);                                          // c[j] += a[j]
+    void (*moments)(int64_t *sx, int64_t *sxx, int64_t *sxy, const int *a, int y, int len); // sums of x, x^2, x*y
+} KernelOps;
+
+// Scalar versions, used on any CPU and for the tails of the vector versions
+static int64_t dot_scalar(const int *a, const int *b, int len)
+{
+    int64_t sum = 0;
+    for (int j = 0; j < len; j++)
+    {
+        sum += (int64_t)a[j] * b[j];
+    }
+    return sum;
+}
+
+static int64_t sum_scalar(const int *a, int len)
+{
+    int64_t sum = 0;
+    for (int j = 0; j < len; j++)
+    {
+        sum += a[j];
+    }
+    return sum;
+}
+
+static void add_scalar(int64_t *c, const int *a, int len)
+{
+    for (int j = 0; j < len; j++)
+    {
+        c[j] += a[j];
+    }
+}
+
+static void moments_scalar(int64_t *sx, int64_t *sxx, int64_t *sxy, const int *a, int y, int len)
+{
+    for (int j = 0; j < len; j++)
+    {
+        int64_t x = a[j];
+        sx[j] += x;
+        sxx[j] += x * x;
+        sxy[j] += x * y;
+    }
+}
+
+static const KernelOps ops_scalar = {"scalar", dot_scalar, sum_scalar, add_scalar, moments_scalar};
+
+#if defined(__x86_64__)
+// AVX2 versions
+// Elements are widened to 64-bit lanes; _mm256_mul_epi32 multiplies the low
+// 32 bits of every lane into an exact 64-bit product
+__attribute__((target("avx2"))) static int64_t dot_avx2(const int *a, const int *b, int len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + j));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + j));
+        acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));                                                // even elements
+        acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32))); // odd elements
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(a + j, b + j, len - j);
+}
+
+__attribute__((target("avx2"))) static int64_t sum_avx2(const int *a, int len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + j))));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + j + 4))));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(a + j, len - j);
+}
+
+__attribute__((target("avx2"))) static void add_avx2(int64_t *c, const int *a, int len)
+{
+    int j = 0;
+    for (; j + 4 <= len; j += 4)
+    {
+        __m256i x = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + j)));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(c + j));
+        _mm256_storeu_si256((__m256i *)(c + j), _mm256_add_epi64(s, x));
+    }
+    add_scalar(c + j, a + j, len - j);
+}
+
+__attribute__((target("avx2"))) static void moments_avx2(int64_t *sx, int64_t *sxx, int64_t *sxy, const int *a, int y, int len)
+{
+    __m256i yv = _mm256_set1_epi64x(y);
+    int j = 0;
+    for (; j + 4 <= len; j += 4)
+    {
+        __m256i x = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + j)));
+        __m256i s1 = _mm256_loadu_si256((const __m256i *)(sx + j));
+        __m256i s2 = _mm256_loadu_si256((const __m256i *)(sxx + j));
+        __m256i s3 = _mm256_loadu_si256((const __m256i *)(sxy + j));
+        _mm256_storeu_si256((__m256i *)(sx + j), _mm256_add_epi64(s1, x));
+        _mm256_storeu_si256((__m256i *)(sxx + j), _mm256_add_epi64(s2, _mm256_mul_epi32(x, x)));
+        _mm256_storeu_si256((__m256i *)(sxy + j), _mm256_add_epi64(s3, _mm256_mul_epi32(x, yv)));
+    }
+    moments_scalar(sx + j, sxx + j, sxy + j, a + j, y, len - j);
+}
+
+static const KernelOps ops_avx2 = {"avx2", dot_avx2, sum_avx2, add_avx2, moments_avx2};
+
+// AVX-512 versions, twice as wide
+__attribute__((target("avx512f"))) static int64_t dot_avx512(const int *a, const int *b, int len)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int j = 0;
+    for (; j + 16 <= len; j += 16)
+    {
+        __m512i x = _mm512_loadu_si512((const void *)(a + j));
+        __m512i y = _mm512_loadu_si512((const void *)(b + j));
+        acc = _mm512_add_epi64(acc, _mm512_mul_epi32(x, y));                                                // even elements
+        acc = _mm512_add_epi64(acc, _mm512_mul_epi32(_mm512_srli_epi64(x, 32), _mm512_srli_epi64(y, 32))); // odd elements
+    }
+    return _mm512_reduce_add_epi64(acc) + dot_scalar(a + j, b + j, len - j);
+}
+
+__attribute__((target("avx512f"))) static int64_t sum_avx512(const int *a, int len)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int j = 0;
+    for (; j + 16 <= len; j += 16)
+    {
+        acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)(a + j))));
+        acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)(a + j + 8))));
+    }
+    return _mm512_reduce_add_epi64(acc) + sum_scalar(a + j, len - j);
+}
+
+__attribute__((target("avx512f"))) static void add_avx512(int64_t *c, const int *a, int len)
+{
+    int j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        __m512i x = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)(a + j)));
+        __m512i s = _mm512_loadu_si512((const void *)(c + j));
+        _mm512_storeu_si512((void *)(c + j), _mm512_add_epi64(s, x));
+    }
+    add_scalar(c + j, a + j, len - j);
+}
+
+__attribute__((target("avx512f"))) static void moments_avx512(int64_t *sx, int64_t *sxx, int64_t *sxy, const int *a, int y, int len)
+{
+    __m512i yv = _mm512_set1_epi64(y);
+    int j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        __m512i x = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)(a + j)));
+        __m512i s1 = _mm512_loadu_si512((const void *)(sx + j));
+        __m512i s2 = _mm512_loadu_si512((const void *)(sxx + j));
+        __m512i s3 = _mm512_loadu_si512((const void *)(sxy + j));
+        _mm512_storeu_si512((void *)(sx + j), _mm512_add_epi64(s1, x));
+        _mm512_storeu_si512((void *)(sxx + j), _mm512_add_epi64(s2, _mm512_mul_epi32(x, x)));
+        _mm512_storeu_si512((void *)(sxy + j), _mm512_add_epi64(s3, _mm512_mul_epi32(x, yv)));
+    }
+    moments_scalar(sx + j, sxx + j, sxy + j, a + j, y, len - j);
+}
+
+static const KernelOps ops_avx512 = {"avx512", dot_avx512, sum_avx512, add_avx512, moments_avx512};
+#endif
+
+static const KernelOps *ops = NULL; // set by kernel_select
+
+// Function to pick the row primitives for this CPU
+// An explicit level the CPU lacks falls back to the best one it has
+void kernel_select(SimdLevel want)
+{
+    ops = &ops_scalar;
+#if defined(__x86_64__)
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    int has_avx512 = __builtin_cpu_supports("avx512f");
+
+    if ((want == SIMD_AVX512 && !has_avx512) || (want == SIMD_AVX2 && !has_avx2))
+    {
+        fprintf(stderr, "This CPU lacks %s, using the best instruction set it has\n",
+                want == SIMD_AVX512 ? "AVX-512" : "AVX2");
+        want = SIMD_AUTO;
+    }
+
+    if (want == SIMD_AVX512 || (want == SIMD_AUTO && has_avx512))
+        ops = &ops_avx512;
+    else if (want == SIMD_AVX2 || (want == SIMD_AUTO && has_avx2))
+        ops = &ops_avx2;
+#else
+    if (want == SIMD_AVX2 || want == SIMD_AVX512)
+        fprintf(stderr, "SIMD kernels need an x86-64 CPU, using scalar code\n");
+#endif
+}
+
+// Function to get the name of the instruction set the kernels use
+const char *kernel_isa(void)
+{
+    if (ops == NULL)
+        kernel_select(SIMD_AUTO);
+    return ops->name;
+}
+
+// Kernels over one tile of rows x cols elements
+// Columns are walked in blocks of KERNEL_BLOCK_COLS so the vector slice or the
+// column accumulators being updated stay in cache while the rows stream past
+static void tile_matvec(const int *data, int rows, int cols, const int *x, int64_t *y)
+{
+    for (int jb = 0; jb < cols; jb += KERNEL_BLOCK_COLS)
+    {
+        int len = (cols - jb < KERNEL_BLOCK_COLS) ? cols - jb : KERNEL_BLOCK_COLS;
+        for (int i = 0; i < rows; i++)
+        {
+            y[i] += ops->dot(data + (size_t)i * cols + jb, x + jb, len);
+        }
+    }
+}
+
+static void tile_rowsum(const int *data, int rows, int cols, int64_t *r)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        r[i] += ops->sum(data + (size_t)i * cols, cols);
+    }
+}
+
+static void tile_colsum(const int *data, int rows, int cols, int64_t *c)
+{
+    for (int jb = 0; jb < cols; jb += KERNEL_BLOCK_COLS)
+    {
+        int len = (cols - jb < KERNEL_BLOCK_COLS) ? cols - jb : KERNEL_BLOCK_COLS;
+        for (int i = 0; i < rows; i++)
+        {
+            ops->add(c + jb, data + (size_t)i * cols + jb, len);
+        }
+    }
+}
+
+static void tile_pearson(const int *data, int rows, int cols, const int *y, int64_t *sx, int64_t *sxx, int64_t *sxy)
+{
+    for (int jb = 0; jb < cols; jb += KERNEL_BLOCK_COLS)
+    {
+        int len = (cols - jb < KERNEL_BLOCK_COLS) ? cols - jb : KERNEL_BLOCK_COLS;
+        for (int i = 0; i < rows; i++)
+        {
+            ops->moments(sx + jb, sxx + jb, sxy + jb, data + (size_t)i * cols + jb, y[i], len);
+        }
+    }
+}
+
+// Results of real matrices are doubles stored in the 64-bit result slots
+static double real_get(const int64_t *slot)
+{
+    double d;
+    memcpy(&d, slot, sizeof(d));
+    return d;
+}
+
+static void real_add(int64_t *slot, double v)
+{
+    double d = real_get(slot) + v;
+    memcpy(slot, &d, sizeof(d));
+}
+
+// Kernels over a strip of rows x cols doubles, writing double results
+static void tile_real(KernelKind k, const double *data, int first_row, int rows, int cols, const int *vec,
+                      int64_t *result)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        const double *a = data + (size_t)i * cols;
+        double s = 0;
+        switch (k)
+        {
+        case KERNEL_MATVEC:
+            for (int j = 0; j < cols; j++)
+                s += a[j] * vec[j];
+            real_add(result + first_row + i, s);
+            break;
+        case KERNEL_ROWSUM:
+            for (int j = 0; j < cols; j++)
+                s += a[j];
+            real_add(result + first_row + i, s);
+            break;
+        case KERNEL_COLSUM:
+            for (int j = 0; j < cols; j++)
+                real_add(result + j, a[j]);
+            break;
+        case KERNEL_PEARSON:
+            for (int j = 0; j < cols; j++)
+            {
+                real_add(result + j, a[j]);
+                real_add(result + cols + j, a[j] * a[j]);
+                real_add(result + 2 * cols + j, a[j] * vec[first_row + i]);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Function to widen rows of type t into int32 (integer types) or double (real types)
+static void widen_rows(ElemType t, const void *src, size_t count, void *dst)
+{
+    switch (t)
+    {
+    case DTYPE_INT8:
+        for (size_t e = 0; e < count; e++)
+            ((int *)dst)[e] = ((const int8_t *)src)[e];
+        break;
+    case DTYPE_INT16:
+        for (size_t e = 0; e < count; e++)
+            ((int *)dst)[e] = ((const int16_t *)src)[e];
+        break;
+    case DTYPE_FLOAT:
+        for (size_t e = 0; e < count; e++)
+            ((double *)dst)[e] = ((const float *)src)[e];
+        break;
+    case DTYPE_DOUBLE:
+        memcpy(dst, src, count * sizeof(double));
+        break;
+    default:
+        memcpy(dst, src, count * sizeof(int));
+        break;
+    }
+}
+
+// Function to add the contribution of one tile of int32 elements
+static void tile_int32(KernelKind k, const int *data, int first_row, int rows, int cols, const int *vec, int64_t *result)
+{
+    switch (k)
+    {
+    case KERNEL_MATVEC:
+        tile_matvec(data, rows, cols, vec, result + first_row);
+        break;
+    case KERNEL_ROWSUM:
+        tile_rowsum(data, rows, cols, result + first_row);
+        break;
+    case KERNEL_COLSUM:
+        tile_colsum(data, rows, cols, result);
+        break;
+    case KERNEL_PEARSON:
+        tile_pearson(data, rows, cols, vec + first_row, result, result + cols, result + 2 * cols);
+        break;
+    default:
+        break;
+    }
+}
+
+// Function to add the contribution of one tile
+// Other types than int32 are widened a strip of rows at a time, so the strip
+// stays in cache between the conversion and the kernel
+void kernel_tile(KernelKind k, ElemType t, const void *data, int first_row, int rows, int cols, const int *vec,
+                 int64_t *result)
+{
+    if (ops == NULL)
+        kernel_select(SIMD_AUTO);
+    if (t == DTYPE_INT32)
+    {
+        tile_int32(k, (const int *)data, first_row, rows, cols, vec, result);
+        return;
+    }
+    if (k == KERNEL_NONE || rows <= 0 || cols <= 0)
+        return;
+
+    int strip = (cols < KERNEL_STRIP_ELEMS) ? KERNEL_STRIP_ELEMS / cols : 1;
+    int real = dtype_is_real(t);
+    void *wide = malloc((size_t)strip * cols * (real ? sizeof(double) : sizeof(int)));
+    if (wide == NULL)
+    {
+        perror("Kernel buffer allocation failed");
+        return;
+    }
+
+    size_t row_bytes = (size_t)cols * dtype_size(t);
+    for (int r = 0; r < rows; r += strip)
+    {
+        int count = (rows - r < strip) ? rows - r : strip;
+        widen_rows(t, (const char *)data + (size_t)r * row_bytes, (size_t)count * cols, wide);
+        if (real)
+            tile_real(k, (const double *)wide, first_row + r, count, cols, vec, result);
+        else
+            tile_int32(k, (const int *)wide, first_row + r, count, cols, vec, result);
+    }
+    free(wide);
+}
+
+// Function to add results of a matrix of type t
+void kernel_accumulate(ElemType t, int64_t *dst, const int64_t *src, int len)
+{
+    for (int k = 0; k < len; k++)
+    {
+        if (dtype_is_real(t))
+            real_add(dst + k, real_get(src + k));
+        else
+            dst[k] += src[k];
+    }
+}
+
+// Function to set up the output of a job
+int kernel_gather_init(KernelGather *g, KernelKind k, int n, ElemType t)
+{
+    g->kernel = k;
+    g->dtype = t;
+    g->n = n;
+    g->acc = (int64_t *)calloc((k == KERNEL_PEARSON ? 3 : 1) * (size_t)n, sizeof(int64_t));
+    if (g->acc == NULL)
+    {
+        perror("Result allocation failed");
+        return -1;
+    }
+    pthread_mutex_init(&g->lock, NULL);
+    return 0;
+}
+
+// Function to clear the output for the next job
+void kernel_gather_reset(KernelGather *g)
+{
+    pthread_mutex_lock(&g->lock);
+    memset(g->acc, 0, (g->kernel == KERNEL_PEARSON ? 3 : 1) * (size_t)g->n * sizeof(int64_t));
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Function to add the partial results of a block
+void kernel_gather_add(KernelGather *g, const MatrixBlock *blk, const int64_t *partial)
+{
+    int n = g->n;
+
+    pthread_mutex_lock(&g->lock);
+    switch (g->kernel)
+    {
+    case KERNEL_MATVEC:
+    case KERNEL_ROWSUM:
+        kernel_accumulate(g->dtype, g->acc + blk->row_start, partial, blk->num_rows);
+        break;
+    case KERNEL_COLSUM:
+        kernel_accumulate(g->dtype, g->acc + blk->col_start, partial, blk->num_cols);
+        break;
+    case KERNEL_PEARSON:
+        for (int part = 0; part < 3; part++)
+        {
+            kernel_accumulate(g->dtype, g->acc + part * n + blk->col_start, partial + part * blk->num_cols, blk->num_cols);
+        }
+        break;
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Function to find where the results of a block can be written straight into the output
+// A block spanning every column is the only one with its rows, and one spanning
+// every row the only one with its columns, so nothing else adds there
+int64_t *kernel_gather_slot(KernelGather *g, const MatrixBlock *blk, int reduced)
+{
+    if (reduced)
+        return g->acc;
+    switch (g->kernel)
+    {
+    case KERNEL_MATVEC:
+    case KERNEL_ROWSUM:
+        return (blk->num_cols == g->n) ? g->acc + blk->row_start : NULL;
+    case KERNEL_COLSUM:
+        return (blk->num_rows == g->n) ? g->acc + blk->col_start : NULL;
+    case KERNEL_PEARSON: // three sums per column, laid out n apart in the output
+        return (blk->num_rows == g->n && blk->num_cols == g->n) ? g->acc : NULL;
+    default:
+        return NULL;
+    }
+}
+
+// Function to print a summary of the output
+void kernel_gather_print(KernelGather *g, const int *vec)
+{
+    int n = g->n;
+    int shown = n < 3 ? n : 3;
+
+    pthread_mutex_lock(&g->lock);
+    if (g->kernel == KERNEL_PEARSON)
+    {
+        // r[j] = (n sum xy - sum x sum y) / sqrt((n sum x^2 - (sum x)^2) (n sum y^2 - (sum y)^2))
+        double sy = 0, syy = 0;
+        for (int i = 0; i < n; i++)
+        {
+            sy += vec[i];
+            syy += (double)vec[i] * vec[i];
+        }
+
+        double mean = 0;
+        printf("Kernel pearson: %d coefficients, first:", n);
+        int real = dtype_is_real(g->dtype);
+        for (int j = 0; j < n; j++)
+        {
+            double sx = real ? real_get(&g->acc[j]) : (double)g->acc[j];
+            double sxx = real ? real_get(&g->acc[n + j]) : (double)g->acc[n + j];
+            double sxy = real ? real_get(&g->acc[2 * n + j]) : (double)g->acc[2 * n + j];
+            double den = sqrt((n * sxx - sx * sx) * (n * syy - sy * sy));
+            double r = (den > 0) ? (n * sxy - sx * sy) / den : 0;
+            mean += r / n;
+            if (j < shown)
+                printf(" %0.6f", r);
+        }
+        printf(", mean %0.6f\n", mean);
+    }
+    else if (dtype_is_real(g->dtype))
+    {
+        double total = 0;
+        for (int i = 0; i < n; i++)
+        {
+            total += real_get(&g->acc[i]);
+        }
+        printf("Kernel %s: %d values, first:", kernel_name(g->kernel), n);
+        for (int i = 0; i < shown; i++)
+        {
+            printf(" %0.3f", real_get(&g->acc[i]));
+        }
+        printf(", sum %0.3f\n", total);
+    }
+    else
+    {
+        long long total = 0;
+        for (int i = 0; i < n; i++)
+        {
+            total += (long long)g->acc[i];
+        }
+        printf("Kernel %s: %d values, first:", kernel_name(g->kernel), n);
+        for (int i = 0; i < shown; i++)
+        {
+            printf(" %lld", (long long)g->acc[i]);
+        }
+        printf(", sum %lld\n", total);
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Function to release the output
+void kernel_gather_free(KernelGather *g)
+{
+    free(g->acc);
+    g->acc = NULL;
+    pthread_mutex_destroy(&g->lock);
+}
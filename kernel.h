@@ -0,0 +1,106 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "protocol.h"
+#include "options.h"
+
+// Compute kernels run by the slaves, and the gathering of their results on the master
+//
+// Every kernel is a sum over the elements of a block, so a block produces
+// partial results (per row or per column) that the master adds into the
+// final output, whatever the layout or schedule that produced the block
+//   matvec  : y[i] = sum_j M[i][j] x[j], needs x over the block's columns
+//   rowsum  : r[i] = sum_j M[i][j]
+//   colsum  : c[j] = sum_i M[i][j]
+//   pearson : per column j, sum x, sum x^2 and sum x*y over the block's rows,
+//             needs y over the block's rows; the master turns them into r[j]
+// Results are exact 64-bit integers, so gathering in any order gives the same output
+// Integer matrices of any width run the same int32 kernels on widened rows;
+// float and double matrices are summed in double precision, and their
+// results travel in the same 64-bit slots as the bit patterns of doubles
+// The vector stays 32-bit integers whatever the matrix type
+
+#define KERNEL_BLOCK_COLS 1024   // columns per cache block: the vector slice and accumulators stay in L1
+#define KERNEL_STRIP_ELEMS 16384 // elements widened at a time for the types other than int32
+
+// Picks the instruction set of the kernels (CPUID at run time, with a scalar fallback)
+// Called once before any kernel runs; until then the best available one is used
+void kernel_select(SimdLevel want);
+
+// Returns the name of the instruction set the kernels use
+const char *kernel_isa(void);
+
+// Returns the name of a kernel
+const char *kernel_name(KernelKind k);
+
+// Describes the work for blk: kernel id and the slice of the full vector vec it needs
+void kernel_task(KernelKind k, const MatrixBlock *blk, const int *vec, BlockTask *task);
+
+// Makes the task of the slave of broadcast rank rank (of size) carry its part of a
+// broadcast of the full vector vec (n elements) instead of its own slice
+// Returns the header flag to send the block with, 0 (task unchanged) when mode is
+// direct or the kernel needs no vector
+uint32_t kernel_task_broadcast(BroadcastMode mode, const int *vec, int n, int rank, int size, BlockTask *task);
+
+// Makes the task of the slave of rank rank (of size) part of a reduce of the results
+// Returns the header flag to send the block with, 0 (task unchanged) when mode is
+// direct or the kernel has no results
+uint32_t kernel_task_reduce(ReduceMode mode, int rank, int size, BlockTask *task);
+
+// Returns the number of results the master gets back for blk of an n x n matrix,
+// sent with task and flags (under a reduce, the whole output from rank 0 and none from the others)
+int kernel_reply_len(const BlockTask *task, uint32_t flags, const MatrixBlock *blk, int n);
+
+// Returns the number of elements of the vector a kernel needs for a block of rows x cols
+int kernel_vector_len(KernelKind k, int rows, int cols);
+
+// Returns the position in the full vector of the slice a kernel needs for a block
+int kernel_vector_start(KernelKind k, int start_row, int col_start);
+
+// Returns the number of 64-bit results a kernel produces for a block of rows x cols
+int kernel_result_len(KernelKind k, int rows, int cols);
+
+// Adds the contribution of a tile of rows x cols elements of type t (row-major), starting at
+// row first_row of its block, to result (kernel_result_len values, zeroed beforehand)
+// vec is the block's vector
+void kernel_tile(KernelKind k, ElemType t, const void *data, int first_row, int rows, int cols, const int *vec,
+                 int64_t *result);
+
+// Adds len results of a matrix of type t from src into dst
+void kernel_accumulate(ElemType t, int64_t *dst, const int64_t *src, int len);
+
+// Output of a job, assembled from the partial results of every block
+typedef struct
+{
+    pthread_mutex_t lock; // blocks may complete on several threads at once
+    KernelKind kernel;
+    ElemType dtype; // type of the matrix, real types accumulate doubles
+    int n;
+    int64_t *acc; // n values (3 * n for pearson)
+} KernelGather;
+
+// Sets up the output of an n x n job over a matrix of type t
+// Returns 0 on success, -1 on error
+int kernel_gather_init(KernelGather *g, KernelKind k, int n, ElemType t);
+
+// Clears the output for the next job
+void kernel_gather_reset(KernelGather *g);
+
+// Adds the partial results of blk
+void kernel_gather_add(KernelGather *g, const MatrixBlock *blk, const int64_t *partial);
+
+// Returns where the results of blk can be decoded straight into the output, when
+// no other block of the job adds to that range (reduced: the whole output
+// from a reduce), or NULL when they have to be added with kernel_gather_add
+int64_t *kernel_gather_slot(KernelGather *g, const MatrixBlock *blk, int reduced);
+
+// Prints a summary of the output; vec is the broadcast vector (used by pearson)
+void kernel_gather_print(KernelGather *g, const int *vec);
+
+// Releases the output
+void kernel_gather_free(KernelGather *g);
+
+#endif
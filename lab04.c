@@ -11,90 +11,65 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <sched.h>
+#include "matrix.h"
+#include "transfer.h"
+#include "protocol.h"
+#include "options.h"
+#include "slave.h"
+#include "cluster.h"
+#include "partition.h"
+#include "kernel.h"
+#include "connpool.h"
 
-#define MAX_SLAVES 32
-#define MAX_IP_LEN 64
 #define BUFFER_SIZE 1024
 #define CONFIG_FILE "config.txt"
 
-// Structure to store slave information
-typedef struct
+// Function to wait for the acknowledgment and the results of the block sent to slave s
+// Results land straight in the output when no other block adds to their range
+// Returns 0 on success, -1 on error
+static int collect_reply(int fd, int s, const BlockTask *task, uint32_t flags, const MatrixBlock *blk, int n,
+                         KernelGather *gather, int64_t *partial, TransferStats *stats)
 {
-    char ip[MAX_IP_LEN]; // IP address
-    int port;            // port number
-} SlaveInfo;
-
-// Function to read the configuration file
-// Opens and reads the config.txt file line by line
-// Parses each line to extract IP, port, and role(master / slave)
-// For slaves : stores the master's IP address
-// For master : stores all slave information in the slaves array
-// Returns the number of slaves found
-
-int read_config(char master_ip[MAX_IP_LEN], SlaveInfo slaves[], int *num_slaves, int is_slave)
-{
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    if (fp == NULL)
-    {
-        perror("Error opening config file");
+    BlockReply reply;
+    int expected = kernel_reply_len(task, flags, blk, n);
+    int64_t *slot = kernel_gather_slot(gather, blk, (flags & PROTO_FLAG_REDUCE) != 0);
+    if (proto_recv_reply(fd, &reply, stats) != 0 ||
+        (reply.status == PROTO_STATUS_OK && (int)reply.result_count != expected) ||
+        proto_recv_result(fd, &reply, slot ? slot : partial, stats) != 0)
         return -1;
-    }
-
-    char line[256];
-    int slave_count = 0;
-
-    while (fgets(line, sizeof(line), fp))
-    {
-        // Skip comments and empty lines
-        if (line[0] == '#' || line[0] == '\n')
-            continue;
-
-        char ip[MAX_IP_LEN];
-        int port;
-        char role[10];
-
-        if (sscanf(line, "%s %d %s", ip, &port, role) == 3)
-        {
-            if (strcmp(role, "master") == 0)
-            {
-                strcpy(master_ip, ip);            
-                // if (is_slave)
-                // {
-                //     strcpy(master_ip, ip); // copy master ip
-                // }
-            }
-            else if (strcmp(role, "slave") == 0)
-            {
-                if (!is_slave) // if master
-                {
-                    strcpy(slaves[slave_count].ip, ip);
-                    slaves[slave_count].port = port;
-                    slave_count++;
-                }
-            }
-        }
-    }
 
-    fclose(fp);
-    *num_slaves = slave_count;
+    if (reply.status != PROTO_STATUS_OK)
+        printf("Slave %d rejected its block (status %u)\n", s, reply.status);
+    else if (slot == NULL && expected > 0)
+        kernel_gather_add(gather, blk, partial);
     return 0;
 }
 
 // Function to run as master
-int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[])
+int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[], const Options *opts)
 {
-    printf("Running as master with n=%d, port=%d, slaves=%d\n", n, port, num_slaves);
+    printf("Running as master with n=%d, port=%d, slaves=%d, seed=%lld, dtype=%s\n", n, port, num_slaves, opts->seed,
+           dtype_name(opts->dtype));
 
     // Create a non-zero n × n square matrix M with random positive integers
-    int **M = (int **)malloc(n * sizeof(int *));
-    for (int i = 0; i < n; i++)
+    // M is stored contiguously, so each slave's row block is one span
+    // With a matrix file, M is mapped from it and only generated when the file is new
+    Matrix M;
+    MatrixFileInfo file;
+    file.rows = n;
+    file.cols = n;
+    file.dtype = opts->dtype;
+    file.row_start = 0;
+    file.col_start = 0;
+    file.seed = (uint64_t)opts->seed;
+    int generate = 1;
+    if ((opts->matrix_file[0] != '\0') ? matrix_open_file(&M, opts->matrix_file, &file, &generate)
+                                       : matrix_alloc(&M, n, n, opts->dtype))
     {
-        M[i] = (int *)malloc(n * sizeof(int));
-        for (int j = 0; j < n; j++)
-        {
-            M[i][j] = (rand() % 9) + 1; // Random numbers from 1 to 9
-        }
+        return -1;
     }
+    if (generate)
+        matrix_fill_seeded(&M, (uint64_t)opts->seed, 0); // Random numbers from 1 to 9, rows filled in parallel
 
     // Function to print an n x n matrix
     // void print_matrix(int **M, int n)
@@ -113,198 +88,181 @@ int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[])
     // printf("My Matrix: \n\n");
     // print_matrix(M, n); // Print the matrix for verification
 
-    // Calculate rows per slave
-    int rows_per_slave = n / num_slaves;
-
-    // Start timer
-    struct timespec time_before, time_after;
-    clock_gettime(CLOCK_MONOTONIC, &time_before);
-
-    // For each slave, create a socket, connect, and send data
-    for (int s = 0; s < num_slaves; s++)
-    {
-        // Create socket
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0)
-        {
-            perror("Socket creation failed");
-            continue;
-        }
-
-        // Set up server address
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(slaves[s].port);
-
-        if (inet_pton(AF_INET, slaves[s].ip, &server_addr.sin_addr) <= 0)
-        {
-            perror("Invalid address");
-            close(sock);
-            continue;
-        }
-
-        // Connect to server
-        if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
-        {
-            perror("Connection failed");
-            close(sock);
-            continue;
-        }
-
-        // printf("Connected to slave %d (%s:%d)\n", s, slaves[s].ip, slaves[s].port);
-
-        // Send matrix dimensions
-        send(sock, &n, sizeof(int), 0);
-
-        // Send row start and count
-        int start_row = s * rows_per_slave;
-        int num_rows = (s == num_slaves - 1) ? (n - start_row) : rows_per_slave;
-        send(sock, &start_row, sizeof(int), 0);
-        send(sock, &num_rows, sizeof(int), 0);
-
-        // Send matrix portion
-        for (int i = start_row; i < start_row + num_rows; i++)
-        {
-            send(sock, M[i], n * sizeof(int), 0);
-        }
-
-        // Receive acknowledgment
-        char ack[4];
-        recv(sock, ack, 3, 0);
-        ack[3] = '\0';
-        // printf("Received from slave %d: %s\n", s, ack);
-
-        close(sock);
-    }
-
-    // End timer
-    clock_gettime(CLOCK_MONOTONIC, &time_after);
-    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
-                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
-
-    printf("\nMaster execution time: %0.9f seconds\n", elapsed_time);
-
-    // Free matrix memory
-    for (int i = 0; i < n; i++)
+    // Vector broadcast to the kernels, and the output assembled from their results
+    Matrix V;
+    KernelGather gather;
+    if (matrix_alloc(&V, 1, n, DTYPE_INT32) != 0)
     {
-        free(M[i]);
-    }
-    free(M);
-
-    return 0;
-}
-
-// Function to run as slave
-int run_as_slave(int port, char master_ip[MAX_IP_LEN])
-{
-    // printf("Running as slave with port=%d, master=%s\n", port, master_ip);
-
-    // Create socket
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0)
-    {
-        perror("Socket creation failed");
+        matrix_free(&M);
         return -1;
     }
-
-    // Set socket options to reuse address
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (kernel_gather_init(&gather, opts->kernel, n, opts->dtype) != 0)
     {
-        perror("Setsockopt failed");
+        matrix_free(&V);
+        matrix_free(&M);
         return -1;
     }
+    matrix_fill_seeded(&V, matrix_mix((uint64_t)opts->seed), 1);
 
-    // Bind socket to port
-    struct sockaddr_in address;
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    // Connections to all slaves are opened together up front and kept open
+    // for the probe and every job; each job only replaces the ones that died
+    ConnPool pool;
+    if (connpool_init(&pool, slaves, num_slaves, opts->streams) != 0)
     {
-        perror("Bind failed");
+        kernel_gather_free(&gather);
+        matrix_free(&V);
+        matrix_free(&M);
         return -1;
     }
 
-    // Start listening
-    if (listen(server_fd, 3) < 0)
+    // Per-slave state and the results of one reply, kept for the whole run
+    TransferStats *stats = (TransferStats *)calloc(num_slaves, sizeof(TransferStats));
+    double *weights = (double *)malloc(num_slaves * sizeof(double));
+    MatrixBlock *blocks = (MatrixBlock *)malloc(num_slaves * sizeof(MatrixBlock));
+    BlockTask *tasks = (BlockTask *)malloc(num_slaves * sizeof(BlockTask));
+    uint32_t *sent = (uint32_t *)malloc(num_slaves * sizeof(uint32_t)); // flags each block went out with
+    int64_t *partial = (int64_t *)malloc(((size_t)3 * n + 1) * sizeof(int64_t));
+    if (stats == NULL || weights == NULL || blocks == NULL || tasks == NULL || sent == NULL || partial == NULL)
     {
-        perror("Listen failed");
+        perror("Master allocation failed");
+        free(stats);
+        free(weights);
+        free(blocks);
+        free(tasks);
+        free(sent);
+        free(partial);
+        connpool_free(&pool);
+        kernel_gather_free(&gather);
+        matrix_free(&V);
+        matrix_free(&M);
         return -1;
     }
-
-    // printf("Slave listening on port %d...\n", port);
-
-    // Accept incoming connection
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-
-    int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-    if (client_fd < 0)
+    connpool_prepare(&pool);
+    connpool_print_prepare(&pool);
+    int *socks = pool.fds;
+
+    // Split the matrix in proportion to the capacity of each slave
+    partition_weights(&pool, opts, &M, stats, weights);
+    partition_blocks(n, num_slaves, weights, opts->layout, blocks);
+    partition_print(num_slaves, weights, blocks);
+    uint32_t flags = (opts->payload == PAYLOAD_SEED) ? PROTO_FLAG_SEEDED : 0; // seed only, no tiles
+
+    // Under a reduce slaves wait for the partials of slaves further down the
+    // list, so every block is sent before any reply is collected
+    int reduce = (opts->reduce != REDUCE_DIRECT && opts->kernel != KERNEL_NONE);
+
+    // A sweep runs the jobs once per socket profile
+    int total_jobs = opts->jobs * (opts->sweep ? TRANSFER_SWEEP_PROFILES : 1);
+    const char *sweep_name = NULL;
+    size_t sweep_start = 0; // bytes sent before the current profile
+    double sweep_time = 0;
+
+    for (int job = 0; job < total_jobs; job++)
     {
-        perror("Accept failed");
-        return -1;
-    }
-
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-    // printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-
-    // Start timer
-    struct timespec time_before, time_after;
-    clock_gettime(CLOCK_MONOTONIC, &time_before);
-
-    // Receive matrix dimensions
-    int n;
-    recv(client_fd, &n, sizeof(int), 0);
+        // Switch to the next profile of the sweep on fresh connections
+        if (opts->sweep && job % opts->jobs == 0)
+        {
+            SocketProfile profile;
+            sweep_name = transfer_sweep_profile(job / opts->jobs, &opts->socket, &profile);
+            transfer_set_profile(&profile);
+            transfer_profile_print(sweep_name, &profile);
+            if (job > 0) // the first profile is the configured one, already in use
+                connpool_reset(&pool);
+            sweep_start = 0;
+            sweep_time = 0;
+            for (int s = 0; s < num_slaves; s++)
+                sweep_start += stats[s].bytes_sent;
+        }
 
-    // Receive row start and count
-    int start_row, num_rows;
-    recv(client_fd, &start_row, sizeof(int), 0);
-    recv(client_fd, &num_rows, sizeof(int), 0);
+        // Reconnect what failed before the timer starts, so handshakes are not counted as transfer
+        connpool_prepare(&pool);
 
-    // printf("Receiving submatrix: n=%d, start_row=%d, num_rows=%d\n", n, start_row, num_rows);
+        // Start timer
+        struct timespec time_before, time_after;
+        clock_gettime(CLOCK_MONOTONIC, &time_before);
+        kernel_gather_reset(&gather);
 
-    // Allocate memory for submatrix
-    int **submatrix = (int **)malloc(num_rows * sizeof(int *));
-    for (int i = 0; i < num_rows; i++)
-    {
-        submatrix[i] = (int *)malloc(n * sizeof(int));
-        recv(client_fd, submatrix[i], n * sizeof(int), 0);
-    }
+        // For each connected slave, send data
+        for (int s = 0; s < num_slaves; s++)
+        {
+            if (socks[s] < 0)
+                continue;
+
+            BlockTask *task = &tasks[s];
+            kernel_task(opts->kernel, &blocks[s], (const int *)V.data, task);
+            task->seed = (uint64_t)opts->seed;
+            task->encoding = (uint32_t)opts->encoding;
+            sent[s] = flags | kernel_task_broadcast(opts->broadcast, (const int *)V.data, n, s, num_slaves, task);
+            sent[s] |= kernel_task_reduce(opts->reduce, s, num_slaves, task);
+
+            // Send the block header (matrix dimensions, block position and size),
+            // then the kernel's vector and the matrix portion, striped over the
+            // slave's streams, and wait for the acknowledgment and the results
+            int fds[PROTO_MAX_STREAMS];
+            int streams = connpool_streams(&pool, s, fds);
+            if (proto_send_striped(fds, streams, &M, &blocks[s], task, opts->chunk_rows, sent[s], &stats[s]) != 0 ||
+                (!reduce && collect_reply(socks[s], s, task, sent[s], &blocks[s], n, &gather, partial, &stats[s]) != 0))
+            {
+                perror("Transfer to slave failed");
+                connpool_close(&pool, s); // reconnect on the next job
+                continue;
+            }
+            // printf("Received from slave %d\n", s);
+        }
 
-    // Print a small portion of the submatrix for verification (if matrix is large)
-    // printf("Received submatrix (showing up to 5x5):\n");
-    // for (int i = 0; i < (num_rows < 5 ? num_rows : 5); i++)
-    // {
-    //     for (int j = 0; j < (n < 5 ? n : 5); j++)
-    //     {
-    //         printf("%d ", submatrix[i][j]);
-    //     }
-    //     printf("...\n");
-    // }
+        // Rank 0 answers for the whole reduce, the others only report their status
+        for (int s = 0; reduce && s < num_slaves; s++)
+        {
+            if (socks[s] >= 0 &&
+                collect_reply(socks[s], s, &tasks[s], sent[s], &blocks[s], n, &gather, partial, &stats[s]) != 0)
+            {
+                perror("Transfer to slave failed");
+                connpool_close(&pool, s);
+            }
+        }
 
-    // Send acknowledgment
-    send(client_fd, "ack", 3, 0);
+        // End timer
+        clock_gettime(CLOCK_MONOTONIC, &time_after);
+        double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
+                              (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
 
-    // End timer
-    clock_gettime(CLOCK_MONOTONIC, &time_after);
-    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
-                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
+        if (total_jobs > 1)
+            printf("\nJob %d of %d", job + 1, total_jobs);
+        printf("\nMaster execution time: %0.9f seconds\n", elapsed_time);
+        connpool_print_prepare(&pool);
+        if (opts->kernel != KERNEL_NONE)
+            kernel_gather_print(&gather, (const int *)V.data);
 
-    printf("\nSlave execution time: %0.9f seconds\n", elapsed_time);
+        sweep_time += elapsed_time;
+        if (opts->sweep && (job + 1) % opts->jobs == 0)
+        {
+            size_t bytes = 0;
+            for (int s = 0; s < num_slaves; s++)
+                bytes += stats[s].bytes_sent;
+            transfer_sweep_print(sweep_name, opts->jobs, bytes - sweep_start, sweep_time);
+        }
+    }
 
-    // Clean up
-    for (int i = 0; i < num_rows; i++)
+    // Close the connections and report what went over each of them
+    for (int s = 0; s < num_slaves; s++)
     {
-        free(submatrix[i]);
+        char label[MAX_HOST_LEN + 32];
+        snprintf(label, sizeof(label), "Slave %d (%s:%d)", s, slaves[s].host, slaves[s].port);
+        transfer_stats_print(label, &stats[s]);
+        connpool_print(&pool, s, label);
     }
-    free(submatrix);
-    close(client_fd);
-    close(server_fd);
+    connpool_free(&pool);
+    free(stats);
+    free(weights);
+    free(blocks);
+    free(partial);
+    free(tasks);
+    free(sent);
+    kernel_gather_free(&gather);
+    matrix_free(&V);
+
+    // Free matrix memory
+    matrix_free(&M);
 
     return 0;
 }
@@ -312,12 +270,13 @@ int run_as_slave(int port, char master_ip[MAX_IP_LEN])
 int main(int argc, char *argv[])
 {
     // Check command line arguments
-    if (argc != 4)
+    if (argc < 4)
     {
-        printf("Usage: %s <n> <port> <status>\n", argv[0]);
+        printf("Usage: %s <n> <port> <status> [options]\n", argv[0]);
         printf("  n: size of square matrix (for master), ignored for slave\n");
         printf("  port: port number to listen on\n");
         printf("  status: 0 for master, 1 for slave\n");
+        options_usage();
         return 1;
     }
 
@@ -325,18 +284,23 @@ int main(int argc, char *argv[])
     int port = atoi(argv[2]);   // Port number
     int status = atoi(argv[3]); // Status (0 for master, 1 for slave)
 
-    // Seed random number generator
-    srand(time(NULL));
+    // Read the configuration file once: nodes go to the registry, options to opts,
+    // then the command line options override the file
+    Cluster cluster;
+    Options opts;
+    options_init(&opts);
 
-    // Read configuration file
-    SlaveInfo slaves[MAX_SLAVES];
-    int num_slaves = 0;
-    char master_ip[MAX_IP_LEN] = "";
-
-    if (read_config(master_ip, slaves, &num_slaves, status) != 0)
+    if (cluster_load(&cluster, CONFIG_FILE, status, &opts) != 0 || options_parse_args(&opts, argc, argv, 4) != 0)
     {
         return 1;
     }
+    if (opts.seed < 0)
+        opts.seed = (long long)time(NULL);
+    if (status == 0 && options_apply_matrix_file(&opts) != 0)
+        return 1;
+    transfer_set_profile(&opts.socket);
+    int num_slaves = cluster.num_slaves;
+    const char *master_ip = cluster.master_host;
 
     // Run as master or slave
     if (status == 0)
@@ -348,7 +312,7 @@ int main(int argc, char *argv[])
             return 1;
         }
         printf("\nMaster IP: %s\n", master_ip);
-        run_as_master(n, port, num_slaves, slaves);
+        run_as_master(n, port, num_slaves, cluster.slaves, &opts);
     }
     else
     {
@@ -358,8 +322,11 @@ int main(int argc, char *argv[])
             printf("No master found in configuration file\n");
             return 1;
         }
-        run_as_slave(port, master_ip);
+        if (opts.cpu_slot < 0)
+            opts.cpu_slot = cluster_local_slot(&cluster, port);
+        run_as_slave(port, master_ip, &opts, &cluster);
     }
 
+    cluster_free(&cluster);
     return 0;
 }
\ No newline at end of file
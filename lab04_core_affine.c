@@ -11,173 +11,501 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include "matrix.h"
+#include "transfer.h"
+#include "protocol.h"
+#include "options.h"
+#include "slave.h"
+#include "cluster.h"
+#include "partition.h"
+#include "scheduler.h"
+#include "kernel.h"
+#include "topology.h"
+#include "connpool.h"
 
-#define MAX_SLAVES 32
-#define MAX_IP_LEN 64 // IP address length
 #define BUFFER_SIZE 1024
 #define CONFIG_FILE "config.txt"
 
-// Structure to store slave information
+// Structure used by the master to release jobs to the sender threads
+// and to wait until every thread has finished the current one
 typedef struct
 {
-    char ip[MAX_IP_LEN];
-    int port;
-} SlaveInfo;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int job;  // highest job the threads may start
+    int done; // threads that finished the current job
+} JobGate;
 
 // Structure for thread arguments
 typedef struct
 {
     int slave_idx; // Index of the slave
-    int n;
-    int **M;
-    SlaveInfo slave;
-    int rows_per_slave;
-    int num_slaves;
+    Matrix *M;
+    TileScheduler *sched; // hands out the blocks sent to this slave
+    KernelGather *gather; // output assembled from the slaves' results
+    const int *vec;       // vector broadcast to the kernels
+    ConnPool *pool;       // connections to the slaves, prepared before every job
+    const int *cpus;      // CPU placement of the sender threads
+    int num_cpus;         // 0 = threads not pinned
+    const Options *opts; // run options (chunk size, jobs, ...)
+    JobGate *gate;       // job release / completion
+    TransferStats stats; // counters of this connection over all jobs
 } ThreadArgs;
 
-// Function to read the configuration file
-// SlaveInfo slaves[] is an array of SlaveInfo structures
-// is_slave => 0 for master, 1 for slave
-// if slave is reading, it will set master_ip
-// if master is reading, it will set info for slaves
-int read_config(char master_ip[MAX_IP_LEN], SlaveInfo slaves[], int *num_slaves, int is_slave)
+// Function to block until the master has released the given job
+void job_gate_wait(JobGate *gate, int job)
+{
+    pthread_mutex_lock(&gate->lock);
+    while (gate->job < job)
+        pthread_cond_wait(&gate->cond, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+// Function to report the current job as finished by one thread
+void job_gate_done(JobGate *gate)
+{
+    pthread_mutex_lock(&gate->lock);
+    gate->done++;
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+// Connection states of the event-driven master
+enum
+{
+    CONN_IDLE,       // connected, waiting for the next job
+    CONN_SENDING,    // streaming the block
+    CONN_REPLY,      // waiting for the slave's reply
+    CONN_RESULT,     // receiving the results that follow the reply
+    CONN_CLOSED      // not connected (failed or not opened yet)
+};
+
+// One slave connection driven by an event loop
+typedef struct
 {
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    if (fp == NULL)
+    int slave_idx; // Index of the slave
+    SlaveInfo slave;
+    int fd;
+    int generation;                        // pool's count of connections to the slave when fd was taken over
+    int state;                             // CONN_*
+    int tile;                              // scheduler tile being sent, -1 if none
+    MatrixBlock block;                     // part of M in that tile
+    BlockSender sender;                    // position in the outgoing block
+    unsigned char reply[PROTO_REPLY_SIZE]; // reply being received
+    size_t reply_off;
+    BlockReply decoded;                    // reply once complete
+    unsigned char *result;                 // results being received (encoded)
+    size_t result_off;
+    size_t result_bytes;
+    int64_t *partial;                      // results once decoded
+    int expected;                          // results the reply of the tile must carry
+    int64_t *slot;                         // where they are decoded: the output, or partial
+    TransferStats stats; // counters of this connection over all jobs
+} EventConn;
+
+// Structure for event loop thread arguments
+typedef struct
+{
+    int loop_idx;       // Index of the event loop
+    EventConn **conns;  // connections served by this loop
+    int num_conns;
+    Matrix *M;
+    const Options *opts;
+    JobGate *gate;
+    TileScheduler *sched;
+    KernelGather *gather;
+    const int *vec;
+    ConnPool *pool;  // connections to the slaves, prepared before every job
+    const int *cpus; // CPU placement of the event loops
+    int num_cpus;
+} EventLoopArgs;
+
+// Function to drop a connection after an error
+// The pool opens a new one before the next job
+void event_conn_fail(int epfd, EventConn *c, EventLoopArgs *args, const char *what)
+{
+    fprintf(stderr, "Slave %d (%s:%d): %s: %s\n", c->slave_idx, c->slave.host, c->slave.port, what, strerror(errno));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    connpool_close(args->pool, c->slave_idx);
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+}
+
+// Function to advance one connection as far as its socket allows
+// Returns 1 once the tile has been acknowledged, -1 if the connection failed, 0 otherwise
+int event_conn_progress(int epfd, EventConn *c, EventLoopArgs *args, uint32_t events)
+{
+    if (c->state == CONN_SENDING)
     {
-        perror("Error opening config file");
-        return -1;
+        int rc = proto_sender_step(&c->sender, c->fd, &c->stats);
+        if (rc < 0)
+        {
+            event_conn_fail(epfd, c, args, "Transfer to slave failed");
+            return -1;
+        }
+        if (rc == 0)
+            return 0; // socket full, wait for EPOLLOUT
+
+        // Block sent, now wait for the reply
+        struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->state = CONN_REPLY;
+        c->reply_off = 0;
+        return 0;
     }
 
-    char line[256]; // character buffer for each line
-    int slave_count = 0;
-
-    while (fgets(line, sizeof(line), fp)) // Read file line by line
+    if (c->state == CONN_REPLY && (events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
     {
-        // Skip comments and empty lines
-        if (line[0] == '#' || line[0] == '\n')
-            continue;
+        while (c->reply_off < PROTO_REPLY_SIZE)
+        {
+            long k = recv_some(c->fd, c->reply + c->reply_off, PROTO_REPLY_SIZE - c->reply_off, &c->stats);
+            if (k < 0)
+            {
+                event_conn_fail(epfd, c, args, "Transfer to slave failed");
+                return -1;
+            }
+            if (k == 0)
+                return 0; // rest of the reply not here yet
+            c->reply_off += (size_t)k;
+        }
 
-        char ip[MAX_IP_LEN];
-        int port;
-        char role[10];
+        BlockReply *reply = &c->decoded;
+        if (proto_decode_reply(c->reply, reply) != 0 ||
+            (reply->status == PROTO_STATUS_OK && (int)reply->result_count != c->expected))
+        {
+            errno = EPROTO;
+            event_conn_fail(epfd, c, args, "Bad reply");
+            return -1;
+        }
+        if (reply->status != PROTO_STATUS_OK)
+        {
+            printf("Slave %d rejected its block (status %u)\n", c->slave_idx, reply->status);
+        }
+        c->state = CONN_RESULT;
+        c->result_off = 0;
+        c->result_bytes = reply->result_count ? proto_result_bytes(reply->result_count) : 0;
+    }
 
-        if (sscanf(line, "%s %d %s", ip, &port, role) == 3) // parse each line
+    if (c->state == CONN_RESULT)
+    {
+        while (c->result_off < c->result_bytes)
         {
-            if (strcmp(role, "master") == 0) // strcmp returns 0 if equal strings
+            long k = recv_some(c->fd, c->result + c->result_off, c->result_bytes - c->result_off, &c->stats);
+            if (k < 0)
             {
-                strcpy(master_ip, ip);
-                // if (is_slave) // if slave is reading config
-                // {
-                //     strcpy(master_ip, ip);
-                // }
+                event_conn_fail(epfd, c, args, "Transfer to slave failed");
+                return -1;
             }
-            else if (strcmp(role, "slave") == 0)
+            if (k == 0)
+                return 0; // rest of the results not here yet
+            c->result_off += (size_t)k;
+        }
+
+        if (c->result_bytes > 0)
+        {
+            if (proto_decode_result(c->result, c->decoded.result_count, c->slot) != 0)
             {
-                if (!is_slave) // if master is reading config
-                {
-                    strcpy(slaves[slave_count].ip, ip); // set IP for slave
-                    slaves[slave_count].port = port;    // set port for slave
-                    slave_count++;                      // onto the next slave
-                }
+                errno = EPROTO;
+                event_conn_fail(epfd, c, args, "Bad results");
+                return -1;
             }
+            if (c->slot == c->partial)
+                kernel_gather_add(args->gather, &c->block, c->partial);
         }
+
+        // Nothing to wait for until the next tile
+        struct epoll_event ev = {0, {.ptr = c}};
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->state = CONN_IDLE;
+        return 1;
     }
 
-    fclose(fp);
-    *num_slaves = slave_count;
     return 0;
 }
 
-// Thread function to connect to a slave and send data
-void *slave_thread(void *arg)
+// Function to hand the next tile of the job to a connection and start sending it
+// Returns 1 if the connection has a tile in flight, 0 if there was none left for it
+int event_conn_next(int epfd, EventConn *c, EventLoopArgs *args, int wait)
 {
-    ThreadArgs *args = (ThreadArgs *)arg;
-    int s = args->slave_idx; // slave index
-    int n = args->n;
-    int **M = args->M;
-    SlaveInfo slave = args->slave;
-    int rows_per_slave = args->rows_per_slave;
-    int num_slaves = args->num_slaves;
+    c->tile = scheduler_next(args->sched, c->slave_idx, &c->block, wait);
+    if (c->tile < 0)
+        return 0;
+
+    BlockTask task;
+    kernel_task(args->opts->kernel, &c->block, args->vec, &task);
+    task.seed = (uint64_t)args->opts->seed;
+    task.encoding = (uint32_t)args->opts->encoding;
+    uint32_t flags = (args->opts->payload == PAYLOAD_SEED) ? PROTO_FLAG_SEEDED : 0;
+    if (args->opts->schedule == SCHEDULE_STATIC && c->tile == c->slave_idx) // only a slave's own block joins the broadcast
+    {
+        flags |= kernel_task_broadcast(args->opts->broadcast, args->vec, args->M->cols, c->slave_idx,
+                                       args->sched->num_slaves, &task);
+        flags |= kernel_task_reduce(args->opts->reduce, c->slave_idx, args->sched->num_slaves, &task);
+    }
+    c->expected = kernel_reply_len(&task, flags, &c->block, args->M->cols);
+    c->slot = kernel_gather_slot(args->gather, &c->block, (flags & PROTO_FLAG_REDUCE) != 0);
+    if (c->slot == NULL)
+        c->slot = c->partial;
+    proto_sender_init(&c->sender, args->M, &c->block, &task, args->opts->chunk_rows, flags);
+    struct epoll_event ev = {EPOLLOUT, {.ptr = c}};
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->state = CONN_SENDING;
+    return 1;
+}
 
-    // Set core affinity
-    int max_cores = 11;                                                 // Adjust based on your machine
-    cpu_set_t cpuset;                                                   // A set of CPUs the thread may run on
-    CPU_ZERO(&cpuset);                                                  // initialize the CPU set empty, clearing any previous CPU assignments
-    CPU_SET(s % max_cores, &cpuset);                                    // Assign thread to a specific core
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset); // binds the thread to the CPU set
-
-    // Create socket
-    int sock = socket(AF_INET, SOCK_STREAM, 0); // AF_INET for IPv4, SOCK_STREAM for TCP, 0 for default protocol
-    if (sock < 0)                               // Catch failure
+// Function to settle the tile of a connection once progress reported an outcome
+// Completed tiles are recorded, tiles of failed connections are given back
+// Returns 1 if the connection went on with another tile, 0 otherwise
+int event_conn_finish(int epfd, EventConn *c, EventLoopArgs *args, int rc)
+{
+    int tile = c->tile;
+    c->tile = -1;
+    if (rc < 0)
     {
-        perror("Socket creation failed");
-        pthread_exit(NULL); // terminate thread
+        scheduler_abandon(args->sched, tile, c->slave_idx);
+        return 0;
     }
+    scheduler_complete(args->sched, tile, c->slave_idx);
+    return event_conn_next(epfd, c, args, 0);
+}
+
+// Thread function for the event-driven master
+// Drives all the connections given to it from this one thread with epoll
+void *event_loop_thread(void *arg)
+{
+    EventLoopArgs *args = (EventLoopArgs *)arg;
 
-    // Set up server address
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(slave.port); // host to network short
+    affinity_pin(args->cpus, args->num_cpus, args->loop_idx);
 
-    if (inet_pton(AF_INET, slave.ip, &server_addr.sin_addr) <= 0) // returns 1 if success
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
     {
-        perror("Invalid address");
-        close(sock);
-        pthread_exit(NULL);
+        perror("epoll_create1 failed");
     }
 
-    // Connect to server
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    struct epoll_event events[64];
+
+    for (int job = 0; job < args->opts->jobs; job++)
     {
-        perror("Connection failed");
-        close(sock);
-        pthread_exit(NULL);
+        job_gate_wait(args->gate, job); // wait until the master releases this job
+
+        // Take over the connections the pool (re)opened and give every connection its first tile
+        int pending = 0;
+        for (int k = 0; k < args->num_conns && epfd >= 0; k++)
+        {
+            EventConn *c = args->conns[k];
+            if (c->generation != args->pool->connects[c->slave_idx])
+                c->state = CONN_CLOSED; // replaced by the pool, the old socket is gone
+            if (c->state == CONN_CLOSED)
+            {
+                struct epoll_event ev = {0, {.ptr = c}};
+                c->generation = args->pool->connects[c->slave_idx];
+                c->fd = args->pool->fds[c->slave_idx];
+                if (c->fd < 0 || fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK) != 0 ||
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) != 0)
+                {
+                    c->fd = -1;
+                    continue;
+                }
+                c->state = CONN_IDLE;
+            }
+            pending += event_conn_next(epfd, c, args, 0);
+        }
+
+        // Run until the scheduler has no tile left for any connection of this loop
+        while (pending > 0)
+        {
+            while (pending > 0)
+            {
+                int ready = epoll_wait(epfd, events, 64, -1);
+                if (ready < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    perror("epoll_wait failed");
+                    for (int k = 0; k < args->num_conns; k++)
+                    {
+                        EventConn *c = args->conns[k];
+                        if (c->tile >= 0)
+                        {
+                            event_conn_fail(epfd, c, args, "Event loop failed");
+                            event_conn_finish(epfd, c, args, -1);
+                        }
+                    }
+                    pending = 0;
+                    break;
+                }
+
+                for (int e = 0; e < ready; e++)
+                {
+                    EventConn *c = (EventConn *)events[e].data.ptr;
+                    int rc = event_conn_progress(epfd, c, args, events[e].events);
+                    if (rc != 0 && !event_conn_finish(epfd, c, args, rc))
+                        pending--;
+                }
+            }
+
+            // Nothing in flight here any more: wait for tiles that connections
+            // of other loops may still give back
+            for (int k = 0; k < args->num_conns && epfd >= 0; k++)
+            {
+                EventConn *c = args->conns[k];
+                if (c->state == CONN_IDLE && event_conn_next(epfd, c, args, 1))
+                {
+                    pending++;
+                    break;
+                }
+            }
+        }
+
+        job_gate_done(args->gate); // report this job as finished
     }
 
-    // printf("Thread %d connected to slave (%s:%d)\n", s, slave.ip, slave.port);
+    // The connections stay with the pool, which closes them
+    if (epfd >= 0)
+        close(epfd);
+    pthread_exit(NULL);
+}
 
-    // Send matrix dimensions
-    send(sock, &n, sizeof(int), 0);
+// Thread function to connect to a slave and send data
+void *slave_thread(void *arg)
+{
+    ThreadArgs *args = (ThreadArgs *)arg;
+    int s = args->slave_idx; // slave index
+    Matrix *M = args->M;
+    TileScheduler *sched = args->sched;
+    int64_t *partial = (int64_t *)malloc(((size_t)3 * M->cols + 1) * sizeof(int64_t));
+    uint32_t flags = (args->opts->payload == PAYLOAD_SEED) ? PROTO_FLAG_SEEDED : 0; // seed only, no tiles
 
-    // Send row start and count
-    int start_row = s * rows_per_slave;
-    int num_rows = (s == num_slaves - 1) ? (n - start_row) : rows_per_slave; // remainder handling for last slave
-    send(sock, &start_row, sizeof(int), 0);                                  // send start row
-    send(sock, &num_rows, sizeof(int), 0);                                   // send number of rows
+    // Set core affinity
+    affinity_pin(args->cpus, args->num_cpus, s);
 
-    // Send matrix portion
-    for (int i = start_row; i < start_row + num_rows; i++) // send an entire row of the matrix
+    for (int job = 0; job < args->opts->jobs; job++)
     {
-        send(sock, M[i], n * sizeof(int), 0);
-    }
+        job_gate_wait(args->gate, job); // wait until the master releases this job
+
+        // The pool connected the slave (or reconnected it after a failure) before the job was released
+        // Blocks are striped over all its streams, the reply comes back on the first
+        int fds[PROTO_MAX_STREAMS];
+        int streams = connpool_streams(args->pool, s, fds);
+        int sock = streams > 0 ? fds[0] : -1;
+
+        // Send blocks for as long as the scheduler has work for this slave
+        MatrixBlock block;
+        int tile;
+        while (sock >= 0 && (tile = scheduler_next(sched, s, &block, 1)) >= 0)
+        {
+            BlockReply reply;
+            BlockTask task;
+            kernel_task(args->opts->kernel, &block, args->vec, &task);
+            task.seed = (uint64_t)args->opts->seed;
+            task.encoding = (uint32_t)args->opts->encoding;
+            uint32_t collective = 0;
+            if (args->opts->schedule == SCHEDULE_STATIC && tile == s) // only a slave's own block joins the broadcast and the reduce
+            {
+                collective = kernel_task_broadcast(args->opts->broadcast, args->vec, M->cols, s, args->sched->num_slaves, &task);
+                collective |= kernel_task_reduce(args->opts->reduce, s, args->sched->num_slaves, &task);
+            }
+            int expected = kernel_reply_len(&task, flags | collective, &block, M->cols);
+            int64_t *slot = kernel_gather_slot(args->gather, &block, (collective & PROTO_FLAG_REDUCE) != 0); // results straight into the output
+
+            if (proto_send_striped(fds, streams, M, &block, &task, args->opts->chunk_rows, flags | collective, &args->stats) != 0 || // header (dimensions, block position and size) + vector + block stripes + checksums
+                proto_recv_reply(sock, &reply, &args->stats) != 0 ||                                      // receive acknowledgment
+                (reply.status == PROTO_STATUS_OK && (int)reply.result_count != expected) ||
+                proto_recv_result(sock, &reply, slot ? slot : partial, &args->stats) != 0)                // receive results
+            {
+                perror("Transfer to slave failed");
+                connpool_close(args->pool, s);
+                sock = -1;
+                scheduler_abandon(sched, tile, s); // another slave may take it
+                break;
+            }
+            if (reply.status != PROTO_STATUS_OK)
+            {
+                printf("Thread %d: slave rejected its block (status %u)\n", s, reply.status);
+            }
+            else if (slot == NULL)
+            {
+                kernel_gather_add(args->gather, &block, partial);
+            }
+            // printf("Thread %d received from slave: status %u\n", s, reply.status);
+            scheduler_complete(sched, tile, s);
+        }
 
-    // Receive acknowledgment
-    char ack[4];
-    recv(sock, ack, 3, 0);
-    ack[3] = '\0';
-    // printf("Thread %d received from slave: %s\n", s, ack);
+        job_gate_done(args->gate); // report this job as finished
+    }
 
-    close(sock);
+    free(partial);
     pthread_exit(NULL);
 }
 
+// Function to add up the bytes sent to every slave so far, from the
+// counters of the sender threads or of the event loop connections
+static size_t bytes_sent(int num_slaves, const ThreadArgs *thread_args, const EventConn *conns)
+{
+    size_t bytes = 0;
+    for (int s = 0; s < num_slaves; s++)
+        bytes += conns ? conns[s].stats.bytes_sent : thread_args[s].stats.bytes_sent;
+    return bytes;
+}
+
 // Function to run as master
-int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[])
+int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[], const Options *opts)
 {
-    printf("Running as master with n=%d, port=%d, slaves=%d\n", n, port, num_slaves);
+    printf("Running as master with n=%d, port=%d, slaves=%d, seed=%lld, dtype=%s\n", n, port, num_slaves, opts->seed,
+           dtype_name(opts->dtype));
+
+    // Sender thread (or event loop) i runs on CPU i of the placement
+    int *cpus;
+    int num_cpus = affinity_plan(opts, &cpus);
+    affinity_print(opts, cpus, num_cpus);
+
+    // One thread per slave, or a fixed set of event loops where slave s is served by loop s % num_workers
+    int event_mode = (opts->event_loops > 0);
+    int num_workers = event_mode ? (opts->event_loops < num_slaves ? opts->event_loops : num_slaves) : num_slaves;
+
+    // Each slave's share of the rows is first touched from the CPU of the thread
+    // that sends it, so its pages sit on that thread's NUMA node; the split uses
+    // the config weights since probed ones need the matrix to exist first
+    double *place_weights = (double *)malloc(num_slaves * sizeof(double));
+    MatrixBlock *place_rows = (MatrixBlock *)malloc(num_slaves * sizeof(MatrixBlock));
+    int *place_cpus = (int *)malloc(num_slaves * sizeof(int));
+    for (int s = 0; s < num_slaves; s++)
+    {
+        place_weights[s] = (opts->weights == WEIGHTS_EQUAL) ? 1.0 : slaves[s].weight;
+        place_cpus[s] = (num_cpus > 0) ? cpus[(event_mode ? s % num_workers : s) % num_cpus] : -1;
+    }
+    partition_blocks(n, num_slaves, place_weights, LAYOUT_ROWS, place_rows);
 
     // Create a non-zero n × n square matrix M with random positive integers
-    int **M = (int **)malloc(n * sizeof(int *));
-    for (int i = 0; i < n; i++)
+    // M is stored contiguously, so each slave's row block is one span
+    // With a matrix file, M is mapped from it (its pages are the page cache's,
+    // not placed) and only generated when the file is new
+    Matrix M;
+    MatrixFileInfo file;
+    file.rows = n;
+    file.cols = n;
+    file.dtype = opts->dtype;
+    file.row_start = 0;
+    file.col_start = 0;
+    file.seed = (uint64_t)opts->seed;
+    int generate = 1;
+    int alloc_rc = (opts->matrix_file[0] != '\0')
+                       ? matrix_open_file(&M, opts->matrix_file, &file, &generate)
+                       : matrix_alloc_placed(&M, n, n, opts->dtype, place_rows, place_cpus, num_cpus > 0 ? num_slaves : 0);
+    free(place_weights);
+    free(place_rows);
+    free(place_cpus);
+    if (alloc_rc != 0)
     {
-        M[i] = (int *)malloc(n * sizeof(int));
-        for (int j = 0; j < n; j++)
-        {
-            M[i][j] = (rand() % 9) + 1; // Random numbers from 1 to 9
-        }
+        free(cpus);
+        return -1;
     }
+    if (generate)
+        matrix_fill_seeded(&M, (uint64_t)opts->seed, 0); // Random numbers from 1 to 9, rows filled in parallel
 
     // Function to print an n x n matrix
     // void print_matrix(int **M, int n)
@@ -196,175 +524,253 @@ int run_as_master(int n, int port, int num_slaves, SlaveInfo slaves[])
     // printf("My Matrix: \n\n");
     // print_matrix(M, n); // Print the matrix for verification
 
-    // Calculate rows per slave
-    int rows_per_slave = n / num_slaves;
-
-    // Start timer
-    struct timespec time_before, time_after;
-    clock_gettime(CLOCK_MONOTONIC, &time_before);
-
-    // Create a thread for each slave
-    pthread_t threads[MAX_SLAVES];
-    ThreadArgs thread_args[MAX_SLAVES];
-
-    for (int s = 0; s < num_slaves; s++)
+    // Connections to all slaves are opened together up front, used by the
+    // probe, then handed over to the senders for every job; the event loops
+    // drive a single non-blocking stream per slave, so only sender threads stripe
+    ConnPool pool;
+    if (connpool_init(&pool, slaves, num_slaves, event_mode ? 0 : opts->streams) != 0)
     {
-        thread_args[s].slave_idx = s;
-        thread_args[s].n = n;
-        thread_args[s].M = M;
-        thread_args[s].slave = slaves[s];
-        thread_args[s].rows_per_slave = rows_per_slave;
-        thread_args[s].num_slaves = num_slaves;
-
-        if (pthread_create(&threads[s], NULL, slave_thread, (void *)&thread_args[s]) != 0)
-        {
-            perror("Thread creation failed");
-        }
+        matrix_free(&M);
+        free(cpus);
+        return -1;
     }
-
-    // Wait for all threads to complete
-    for (int s = 0; s < num_slaves; s++)
+    connpool_prepare(&pool);
+    connpool_print_prepare(&pool);
+
+    // Split the matrix in proportion to the capacity of each slave
+    TransferStats *probe_stats = (TransferStats *)calloc(num_slaves, sizeof(TransferStats));
+    double *weights = (double *)malloc(num_slaves * sizeof(double));
+    MatrixBlock *blocks = (MatrixBlock *)malloc(num_slaves * sizeof(MatrixBlock));
+    partition_weights(&pool, opts, &M, probe_stats, weights);
+    partition_blocks(n, num_slaves, weights, opts->layout, blocks);
+    partition_print(num_slaves, weights, blocks);
+
+    // The scheduler hands each slave its block, or row tiles in dynamic mode
+    TileScheduler sched;
+    int dynamic = (opts->schedule == SCHEDULE_DYNAMIC);
+    int sched_rows = opts->sched_rows > 0 ? opts->sched_rows : (n + 8 * num_slaves - 1) / (8 * num_slaves);
+    if ((dynamic ? scheduler_init_dynamic(&sched, n, num_slaves, weights, sched_rows)
+                 : scheduler_init_static(&sched, num_slaves, blocks)) != 0)
     {
-        pthread_join(threads[s], NULL);
+        connpool_free(&pool);
+        matrix_free(&M);
+        free(cpus);
+        return -1;
     }
 
-    // End timer
-    clock_gettime(CLOCK_MONOTONIC, &time_after);
-    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
-                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
-
-    printf("\nMaster execution time: %0.9f seconds\n", elapsed_time);
-
-    // Free matrix memory
-    for (int i = 0; i < n; i++)
+    // Vector broadcast to the kernels, and the output assembled from their results
+    Matrix V;
+    KernelGather gather;
+    if (matrix_alloc(&V, 1, n, DTYPE_INT32) != 0 || kernel_gather_init(&gather, opts->kernel, n, opts->dtype) != 0)
     {
-        free(M[i]);
+        connpool_free(&pool);
+        matrix_free(&M);
+        free(cpus);
+        return -1;
     }
-    free(M);
+    matrix_fill_seeded(&V, matrix_mix((uint64_t)opts->seed), 1);
+
+    // Job 0 is released right away, later jobs are released one at a time
+    JobGate gate;
+    pthread_mutex_init(&gate.lock, NULL);
+    pthread_cond_init(&gate.cond, NULL);
+    gate.job = 0;
+    gate.done = 0;
+
+    // A sweep runs the jobs once per socket profile, the first being the
+    // configured one; the threads see it as one longer run
+    Options run = *opts;
+    run.jobs = opts->jobs * (opts->sweep ? TRANSFER_SWEEP_PROFILES : 1);
+    SocketProfile profile;
+    const char *sweep_name = transfer_sweep_profile(0, &opts->socket, &profile);
+    size_t sweep_start = 0; // bytes sent before the current profile
+    double sweep_time = 0;
+    if (opts->sweep)
+        transfer_profile_print(sweep_name, &profile);
+
+    // Health-check the connections before the timer starts, so handshakes are not counted as transfer
+    connpool_prepare(&pool);
 
-    return 0;
-}
+    // Start timer
+    struct timespec time_before, time_after;
+    clock_gettime(CLOCK_MONOTONIC, &time_before);
 
-// Function to run as slave
-int run_as_slave(int port, char master_ip[MAX_IP_LEN])
-{
-    // printf("Running as slave with port=%d, master=%s\n", port, master_ip);
-    // printf("Running as slave with port=%d\n", port);
-
-    // Set core affinity to a specific core (e.g., core 0)
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset); // Use core 0
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-
-    // Create socket
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0)
+    // Create a thread for each slave, or a fixed set of event loops
+    // that share the slave connections between them
+    pthread_t *threads = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+    int *started = (int *)calloc(num_workers, sizeof(int));
+    ThreadArgs *thread_args = NULL;
+    EventConn *conns = NULL;
+    EventConn **conn_refs = NULL;
+    EventLoopArgs *loop_args = NULL;
+    int num_started = 0;
+
+    if (event_mode)
     {
-        perror("Socket creation failed");
-        return -1;
-    }
+        conns = (EventConn *)calloc(num_slaves, sizeof(EventConn));
+        conn_refs = (EventConn **)malloc(num_slaves * sizeof(EventConn *));
+        loop_args = (EventLoopArgs *)calloc(num_workers, sizeof(EventLoopArgs));
 
-    // Set socket options to reuse address
-    // SOL_SOCKET indicates that the option is at socket level
-    // SO_REUSEADDR allows the socket to bind to an address that is already in use
-    int opt = 1; // enabled for socket option
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+        // Slave s is served by loop s % num_workers
+        int next = 0;
+        for (int w = 0; w < num_workers; w++)
+        {
+            loop_args[w].loop_idx = w;
+            loop_args[w].conns = conn_refs + next;
+            loop_args[w].M = &M;
+            loop_args[w].opts = &run;
+            loop_args[w].gate = &gate;
+            loop_args[w].sched = &sched;
+            loop_args[w].gather = &gather;
+            loop_args[w].vec = (const int *)V.data;
+            loop_args[w].pool = &pool;
+            loop_args[w].cpus = cpus;
+            loop_args[w].num_cpus = num_cpus;
+            for (int s = w; s < num_slaves; s += num_workers)
+            {
+                conns[s].slave_idx = s;
+                conns[s].slave = slaves[s];
+                conns[s].fd = -1;
+                conns[s].state = CONN_CLOSED; // the loop takes over the pool's connection
+                conns[s].tile = -1;
+                conns[s].result = (unsigned char *)malloc(proto_result_bytes(3 * (uint32_t)n));
+                conns[s].partial = (int64_t *)malloc(((size_t)3 * n + 1) * sizeof(int64_t));
+                conns[s].stats = probe_stats[s];
+                conn_refs[next++] = &conns[s];
+                loop_args[w].num_conns++;
+            }
+        }
+    }
+    else
     {
-        perror("Setsockopt failed");
-        return -1;
+        thread_args = (ThreadArgs *)calloc(num_slaves, sizeof(ThreadArgs));
     }
 
-    // Bind socket to port
-    struct sockaddr_in address;
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    for (int w = 0; w < num_workers; w++)
     {
-        perror("Bind failed");
-        return -1;
+        if (event_mode)
+        {
+            started[w] = (pthread_create(&threads[w], NULL, event_loop_thread, (void *)&loop_args[w]) == 0);
+        }
+        else
+        {
+            thread_args[w].slave_idx = w;
+            thread_args[w].M = &M;
+            thread_args[w].sched = &sched;
+            thread_args[w].gather = &gather;
+            thread_args[w].vec = (const int *)V.data;
+            thread_args[w].pool = &pool;
+            thread_args[w].cpus = cpus;
+            thread_args[w].num_cpus = num_cpus;
+            thread_args[w].stats = probe_stats[w];
+            thread_args[w].opts = &run;
+            thread_args[w].gate = &gate;
+
+            started[w] = (pthread_create(&threads[w], NULL, slave_thread, (void *)&thread_args[w]) == 0);
+        }
+        if (!started[w])
+        {
+            perror("Thread creation failed");
+            continue;
+        }
+        num_started++;
     }
 
-    // Start listening
-    if (listen(server_fd, 3) < 0)
+    for (int job = 0; job < run.jobs; job++)
     {
-        perror("Listen failed");
-        return -1;
-    }
+        if (job > 0)
+        {
+            // Switch to the next profile of the sweep on fresh connections
+            if (opts->sweep && job % opts->jobs == 0)
+            {
+                sweep_name = transfer_sweep_profile(job / opts->jobs, &opts->socket, &profile);
+                transfer_set_profile(&profile);
+                transfer_profile_print(sweep_name, &profile);
+                connpool_reset(&pool);
+                sweep_start = bytes_sent(num_slaves, thread_args, conns);
+                sweep_time = 0;
+            }
 
-    // printf("Slave listening on port %d...\n", port);
+            // Reconnect what failed, then start the timer and release the next job
+            connpool_prepare(&pool);
+            scheduler_reset(&sched);
+            kernel_gather_reset(&gather);
+            clock_gettime(CLOCK_MONOTONIC, &time_before);
+            pthread_mutex_lock(&gate.lock);
+            gate.done = 0;
+            gate.job = job;
+            pthread_cond_broadcast(&gate.cond);
+            pthread_mutex_unlock(&gate.lock);
+        }
 
-    // Accept incoming connection
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+        // Wait for all threads to complete the job
+        pthread_mutex_lock(&gate.lock);
+        while (gate.done < num_started)
+            pthread_cond_wait(&gate.cond, &gate.lock);
+        pthread_mutex_unlock(&gate.lock);
+
+        // End timer
+        clock_gettime(CLOCK_MONOTONIC, &time_after);
+        double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
+                              (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
+
+        if (run.jobs > 1)
+            printf("\nJob %d of %d", job + 1, run.jobs);
+        printf("\nMaster execution time: %0.9f seconds\n", elapsed_time);
+        connpool_print_prepare(&pool);
+
+        int missing = scheduler_missing(&sched);
+        if (missing > 0)
+            printf("%d of %d blocks were not delivered\n", missing, sched.num_tiles);
+        if (opts->kernel != KERNEL_NONE)
+            kernel_gather_print(&gather, (const int *)V.data);
+
+        sweep_time += elapsed_time;
+        if (opts->sweep && (job + 1) % opts->jobs == 0)
+            transfer_sweep_print(sweep_name, opts->jobs, bytes_sent(num_slaves, thread_args, conns) - sweep_start,
+                                 sweep_time);
+    }
 
-    int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-    if (client_fd < 0)
+    // Wait for all threads to close their connections, then report them
+    for (int w = 0; w < num_workers; w++)
     {
-        perror("Accept failed");
-        return -1;
+        if (started[w])
+            pthread_join(threads[w], NULL);
     }
-
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-    // printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-    // printf("Connection accepted.\n");
-
-    // Start timer
-    struct timespec time_before, time_after;
-    clock_gettime(CLOCK_MONOTONIC, &time_before);
-
-    // Receive matrix dimensions
-    int n;
-    recv(client_fd, &n, sizeof(int), 0);
-
-    // Receive row start and count
-    int start_row, num_rows;
-    recv(client_fd, &start_row, sizeof(int), 0);
-    recv(client_fd, &num_rows, sizeof(int), 0);
-
-    // printf("Receiving submatrix: n=%d, start_row=%d, num_rows=%d\n", n, start_row, num_rows);
-
-    // Allocate memory for submatrix
-    int **submatrix = (int **)malloc(num_rows * sizeof(int *));
-    for (int i = 0; i < num_rows; i++)
+    if (dynamic)
+        scheduler_print(&sched);
+    for (int s = 0; s < num_slaves; s++)
     {
-        submatrix[i] = (int *)malloc(n * sizeof(int));
-        recv(client_fd, submatrix[i], n * sizeof(int), 0);
+        char label[MAX_HOST_LEN + 32];
+        snprintf(label, sizeof(label), "%s %d (%s:%d)", event_mode ? "Slave" : "Thread", s, slaves[s].host, slaves[s].port);
+        transfer_stats_print(label, event_mode ? &conns[s].stats : &thread_args[s].stats);
+        connpool_print(&pool, s, label);
     }
-
-    // Print a small portion of the submatrix for verification (if matrix is large)
-    // printf("Received submatrix (showing up to 5x5):\n");
-    // for (int i = 0; i < (num_rows < 5 ? num_rows : 5); i++)
-    // {
-    //     for (int j = 0; j < (n < 5 ? n : 5); j++)
-    //     {
-    //         printf("%d ", submatrix[i][j]);
-    //     }
-    //     printf("...\n");
-    // }
-
-    // Send acknowledgment
-    send(client_fd, "ack", 3, 0);
-
-    // End timer
-    clock_gettime(CLOCK_MONOTONIC, &time_after);
-    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
-                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
-
-    printf("\nSlave execution time: %0.9f seconds", elapsed_time);
-
-    // Clean up
-    for (int i = 0; i < num_rows; i++)
+    connpool_free(&pool);
+    for (int s = 0; event_mode && s < num_slaves; s++)
     {
-        free(submatrix[i]);
+        free(conns[s].result);
+        free(conns[s].partial);
+        proto_sender_free(&conns[s].sender);
     }
-    free(submatrix);
-    close(client_fd);
-    close(server_fd);
+    free(threads);
+    free(started);
+    free(thread_args);
+    free(conns);
+    free(conn_refs);
+    free(loop_args);
+    free(probe_stats);
+    free(weights);
+    free(blocks);
+    free(cpus);
+    scheduler_free(&sched);
+    kernel_gather_free(&gather);
+    matrix_free(&V);
+    pthread_mutex_destroy(&gate.lock);
+    pthread_cond_destroy(&gate.cond);
+
+    // Free matrix memory
+    matrix_free(&M);
 
     return 0;
 }
@@ -372,12 +778,13 @@ int run_as_slave(int port, char master_ip[MAX_IP_LEN])
 int main(int argc, char *argv[])
 {
     // Check command line arguments
-    if (argc != 4)
+    if (argc < 4)
     {
-        printf("Usage: %s <n> <port> <status>\n", argv[0]);
+        printf("Usage: %s <n> <port> <status> [options]\n", argv[0]);
         printf("  n: size of square matrix (for master), ignored for slave\n");
         printf("  port: port number to listen on\n");
         printf("  status: 0 for master, 1 for slave\n");
+        options_usage();
         return 1;
     }
 
@@ -385,19 +792,25 @@ int main(int argc, char *argv[])
     int port = atoi(argv[2]);   // Port number
     int status = atoi(argv[3]); // Status (0 for master, 1 for slave)
 
-    // Seed random number generator
-    srand(time(NULL));
-
-    // Read configuration file
-    SlaveInfo slaves[MAX_SLAVES];
-    int num_slaves = 0;
-    char master_ip[MAX_IP_LEN] = "";
+    // Read the configuration file once: nodes go to the registry, options to opts,
+    // then the command line options override the file
+    Cluster cluster;
+    Options opts;
+    options_init(&opts);
+    opts.affinity = AFFINITY_COMPACT;
 
     // if failed to read config, return 1
-    if (read_config(master_ip, slaves, &num_slaves, status) != 0)
+    if (cluster_load(&cluster, CONFIG_FILE, status, &opts) != 0 || options_parse_args(&opts, argc, argv, 4) != 0)
     {
         return 1;
     }
+    if (opts.seed < 0)
+        opts.seed = (long long)time(NULL);
+    if (status == 0 && options_apply_matrix_file(&opts) != 0)
+        return 1;
+    transfer_set_profile(&opts.socket);
+    int num_slaves = cluster.num_slaves;
+    const char *master_ip = cluster.master_host;
 
     // Run as master or slave
     if (status == 0) // master role
@@ -409,7 +822,7 @@ int main(int argc, char *argv[])
             return 1;
         }
         printf("\nMaster IP: %s\n", master_ip);
-        run_as_master(n, port, num_slaves, slaves);
+        run_as_master(n, port, num_slaves, cluster.slaves, &opts);
     }
     else // slave role
     {
@@ -419,8 +832,13 @@ int main(int argc, char *argv[])
             printf("No master found in configuration file\n");
             return 1;
         }
-        run_as_slave(port, master_ip);
+
+        // Co-located slaves take different CPUs of the placement
+        if (opts.cpu_slot < 0)
+            opts.cpu_slot = cluster_local_slot(&cluster, port);
+        run_as_slave(port, master_ip, &opts, &cluster);
     }
 
+    cluster_free(&cluster);
     return 0;
 }
\ No newline at end of file
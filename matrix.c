@@ -0,0 +1,481 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix.h"
+
+// Structure for the threads that first-touch a row range
+typedef struct
+{
+    void *start;  // first element of the range
+    size_t bytes; // bytes of the range
+    int cpu;      // CPU to touch from
+} TouchArgs;
+
+// On-disk header of a matrix file, fixed-width fields in the writer's byte order
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t dtype;      // ElemType
+    uint8_t big_endian; // byte order of the header and the payload
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t row_start;
+    uint64_t col_start;
+    uint64_t data_offset;
+    uint64_t seed;
+} MatrixFileHeader;
+
+// Function to tell whether this machine is big-endian
+static int host_big_endian(void)
+{
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 0;
+}
+
+// Function to get the name of an element type
+const char *dtype_name(ElemType t)
+{
+    static const char *const names[] = {"int8", "int16", "int32", "float", "double"};
+    return names[t];
+}
+
+// Function to allocate a matrix
+// One malloc for the whole matrix instead of one per row
+int matrix_alloc(Matrix *m, int rows, int cols, ElemType dtype)
+{
+    m->rows = rows;
+    m->cols = cols;
+    m->dtype = dtype;
+    m->mapped = 0;
+    m->fd = -1;
+    m->file_offset = 0;
+    m->data = malloc((size_t)rows * cols * dtype_size(dtype));
+    if (m->data == NULL && (size_t)rows * cols > 0)
+    {
+        perror("Matrix allocation failed");
+        m->rows = 0;
+        m->cols = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Thread function writing a row range from its CPU, so the kernel backs
+// the pages with memory of that CPU's node
+static void *touch_rows(void *arg)
+{
+    TouchArgs *args = (TouchArgs *)arg;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(args->cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    memset(args->start, 0, args->bytes);
+    return NULL;
+}
+
+// Function to allocate a matrix with its row ranges placed by first touch
+// The pages come straight from mmap so none of them is touched before the placement
+int matrix_alloc_placed(Matrix *m, int rows, int cols, ElemType dtype, const MatrixBlock *ranges, const int *cpus,
+                        int count)
+{
+    size_t bytes = (size_t)rows * cols * dtype_size(dtype);
+    if (count <= 0 || bytes == 0)
+        return matrix_alloc(m, rows, cols, dtype);
+
+    void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Matrix allocation failed");
+        m->rows = 0;
+        m->cols = 0;
+        m->data = NULL;
+        m->mapped = 0;
+        m->fd = -1;
+        return -1;
+    }
+    m->rows = rows;
+    m->cols = cols;
+    m->dtype = dtype;
+    m->data = data;
+    m->mapped = bytes;
+    m->fd = -1;
+    m->file_offset = 0;
+
+    // One thread per range; the pages of a range whose thread cannot start
+    // are placed by whoever writes them first, as with malloc
+    pthread_t *threads = (pthread_t *)malloc(count * sizeof(pthread_t));
+    TouchArgs *args = (TouchArgs *)malloc(count * sizeof(TouchArgs));
+    int *started = (int *)calloc(count, sizeof(int));
+    if (threads != NULL && args != NULL && started != NULL)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            args[i].start = matrix_row(m, ranges[i].row_start);
+            args[i].bytes = matrix_block_bytes(m, ranges[i].num_rows);
+            args[i].cpu = cpus[i];
+            started[i] = (pthread_create(&threads[i], NULL, touch_rows, &args[i]) == 0);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (started[i])
+                pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(args);
+    free(started);
+    return 0;
+}
+
+// Function to check a matrix file header and describe it
+// Returns 0 when valid, -1 otherwise
+static int header_info(const MatrixFileHeader *h, const char *path, MatrixFileInfo *info)
+{
+    if (h->magic == __builtin_bswap32(MATRIX_FILE_MAGIC) || (h->magic == MATRIX_FILE_MAGIC && h->big_endian != host_big_endian()))
+    {
+        fprintf(stderr, "%s was written with the other byte order\n", path);
+        return -1;
+    }
+    if (h->magic != MATRIX_FILE_MAGIC || h->version != MATRIX_FILE_VERSION)
+    {
+        fprintf(stderr, "%s is not a matrix file\n", path);
+        return -1;
+    }
+    if (h->dtype > DTYPE_DOUBLE || h->rows > INT32_MAX || h->cols > INT32_MAX || h->row_start > INT32_MAX ||
+        h->col_start > INT32_MAX || h->data_offset < sizeof(MatrixFileHeader))
+    {
+        fprintf(stderr, "%s has an invalid matrix header\n", path);
+        return -1;
+    }
+    info->rows = (int)h->rows;
+    info->cols = (int)h->cols;
+    info->dtype = (ElemType)h->dtype;
+    info->row_start = (int)h->row_start;
+    info->col_start = (int)h->col_start;
+    info->seed = h->seed;
+    return 0;
+}
+
+// Function to read the header of a matrix file
+int matrix_file_info(const char *path, MatrixFileInfo *info)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return 1;
+        perror(path);
+        return -1;
+    }
+
+    MatrixFileHeader h;
+    ssize_t got = pread(fd, &h, sizeof(h), 0);
+    close(fd);
+    if (got != (ssize_t)sizeof(h))
+    {
+        fprintf(stderr, "%s is not a matrix file\n", path);
+        return -1;
+    }
+    return header_info(&h, path, info);
+}
+
+// Function to map an existing matrix file read-only
+int matrix_map_file(Matrix *m, const char *path, MatrixFileInfo *info)
+{
+    m->rows = 0;
+    m->cols = 0;
+    m->data = NULL;
+    m->mapped = 0;
+    m->fd = open(path, O_RDONLY);
+    if (m->fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    MatrixFileHeader h;
+    struct stat st;
+    if (pread(m->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || fstat(m->fd, &st) != 0)
+        h.magic = 0; // reported as not a matrix file
+    if (header_info(&h, path, info) != 0)
+    {
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+
+    size_t bytes = h.data_offset + (size_t)info->rows * info->cols * dtype_size(info->dtype);
+    if ((size_t)st.st_size < bytes)
+    {
+        fprintf(stderr, "%s is truncated: %zu of %zu bytes\n", path, (size_t)st.st_size, bytes);
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+
+    void *base = mmap(NULL, bytes, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("Matrix file mapping failed");
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+    m->rows = info->rows;
+    m->cols = info->cols;
+    m->dtype = info->dtype;
+    m->file_offset = h.data_offset;
+    m->data = (char *)base + h.data_offset;
+    m->mapped = bytes;
+    return 0;
+}
+
+// Function to create a matrix file and map it read-write
+int matrix_create_file(Matrix *m, const char *path, const MatrixFileInfo *info)
+{
+    m->rows = 0;
+    m->cols = 0;
+    m->data = NULL;
+    m->mapped = 0;
+    m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m->fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    size_t bytes = MATRIX_FILE_DATA_OFFSET + (size_t)info->rows * info->cols * dtype_size(info->dtype);
+    void *base = MAP_FAILED;
+    if (ftruncate(m->fd, (off_t)bytes) == 0)
+        base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("Matrix file creation failed");
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+
+    MatrixFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MATRIX_FILE_MAGIC;
+    h.version = MATRIX_FILE_VERSION;
+    h.dtype = (uint8_t)info->dtype;
+    h.big_endian = (uint8_t)host_big_endian();
+    h.rows = (uint64_t)info->rows;
+    h.cols = (uint64_t)info->cols;
+    h.row_start = (uint64_t)info->row_start;
+    h.col_start = (uint64_t)info->col_start;
+    h.data_offset = MATRIX_FILE_DATA_OFFSET;
+    h.seed = info->seed;
+    memcpy(base, &h, sizeof(h));
+
+    m->rows = info->rows;
+    m->cols = info->cols;
+    m->dtype = info->dtype;
+    m->file_offset = MATRIX_FILE_DATA_OFFSET;
+    m->data = (char *)base + MATRIX_FILE_DATA_OFFSET;
+    m->mapped = bytes;
+    return 0;
+}
+
+// Function to open a matrix file, creating it when missing
+int matrix_open_file(Matrix *m, const char *path, const MatrixFileInfo *want, int *created)
+{
+    MatrixFileInfo info;
+    *created = 0;
+    int rc = matrix_file_info(path, &info);
+    if (rc < 0)
+        return -1;
+    if (rc == 1)
+    {
+        *created = 1;
+        return matrix_create_file(m, path, want);
+    }
+
+    if (info.rows != want->rows || info.cols != want->cols || info.dtype != want->dtype)
+    {
+        fprintf(stderr, "%s holds a %dx%d %s matrix, not %dx%d %s\n", path, info.rows, info.cols,
+                dtype_name(info.dtype), want->rows, want->cols, dtype_name(want->dtype));
+        return -1;
+    }
+    return matrix_map_file(m, path, &info);
+}
+
+// Function to free a matrix
+// A file-backed matrix is unmapped and its file closed; the file itself stays
+void matrix_free(Matrix *m)
+{
+    if (m->mapped > 0)
+        munmap((char *)m->data - m->file_offset, m->mapped);
+    else
+        free(m->data);
+    if (m->fd >= 0)
+        close(m->fd);
+    m->fd = -1;
+    m->file_offset = 0;
+    m->mapped = 0;
+    m->data = NULL;
+    m->rows = 0;
+    m->cols = 0;
+}
+
+// Structure for the threads that fill a range of rows
+typedef struct
+{
+    Matrix *m;
+    uint64_t seed;
+    int first_row;
+    int num_rows;
+} FillArgs;
+
+// Function to fill rows of a block of a seeded matrix
+void matrix_fill_seeded_block(Matrix *m, uint64_t seed, int n, const MatrixBlock *blk, int first, int count)
+{
+    for (int i = first; i < first + count; i++)
+    {
+        void *row = matrix_row(m, i);
+        uint64_t index = (uint64_t)(blk->row_start + i) * n + blk->col_start;
+        switch (m->dtype)
+        {
+        case DTYPE_INT8:
+            for (int j = 0; j < m->cols; j++)
+                ((int8_t *)row)[j] = (int8_t)matrix_seeded_value(seed, index + j);
+            break;
+        case DTYPE_INT16:
+            for (int j = 0; j < m->cols; j++)
+                ((int16_t *)row)[j] = (int16_t)matrix_seeded_value(seed, index + j);
+            break;
+        case DTYPE_INT32:
+            for (int j = 0; j < m->cols; j++)
+                ((int32_t *)row)[j] = matrix_seeded_value(seed, index + j);
+            break;
+        case DTYPE_FLOAT:
+            for (int j = 0; j < m->cols; j++)
+                ((float *)row)[j] = (float)matrix_seeded_real(seed, index + j);
+            break;
+        case DTYPE_DOUBLE:
+            for (int j = 0; j < m->cols; j++)
+                ((double *)row)[j] = matrix_seeded_real(seed, index + j);
+            break;
+        }
+    }
+}
+
+// Function to fill rows [first_row, first_row + num_rows) from the seeded stream
+static void fill_rows(Matrix *m, uint64_t seed, int first_row, int num_rows)
+{
+    MatrixBlock whole = {0, m->rows, 0, m->cols};
+    matrix_fill_seeded_block(m, seed, m->cols, &whole, first_row, num_rows);
+}
+
+// Thread function filling its range of rows
+static void *fill_thread(void *arg)
+{
+    FillArgs *args = (FillArgs *)arg;
+    fill_rows(args->m, args->seed, args->first_row, args->num_rows);
+    return NULL;
+}
+
+// Function to fill a matrix with seeded random numbers from 1 to 9
+// The rows are split evenly between the threads; rows a thread could not
+// be started for are filled by the caller
+void matrix_fill_seeded(Matrix *m, uint64_t seed, int threads)
+{
+    if (threads <= 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? (int)online : 1;
+    }
+    if (threads > m->rows)
+        threads = m->rows > 0 ? m->rows : 1;
+
+    pthread_t *ids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    FillArgs *args = (FillArgs *)malloc(threads * sizeof(FillArgs));
+    int *started = (int *)calloc(threads, sizeof(int));
+    if (threads == 1 || ids == NULL || args == NULL || started == NULL)
+    {
+        fill_rows(m, seed, 0, m->rows);
+    }
+    else
+    {
+        for (int t = 0; t < threads; t++)
+        {
+            args[t].m = m;
+            args[t].seed = seed;
+            args[t].first_row = (int)((long long)m->rows * t / threads);
+            args[t].num_rows = (int)((long long)m->rows * (t + 1) / threads) - args[t].first_row;
+            started[t] = (pthread_create(&ids[t], NULL, fill_thread, &args[t]) == 0);
+            if (!started[t])
+                fill_rows(m, seed, args[t].first_row, args[t].num_rows);
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            if (started[t])
+                pthread_join(ids[t], NULL);
+        }
+    }
+    free(ids);
+    free(args);
+    free(started);
+}
+
+// Function to check that every element of a region is an integer in [lo, hi]
+int matrix_block_in_range(const Matrix *m, const MatrixBlock *blk, int lo, int hi)
+{
+    if (dtype_is_real(m->dtype))
+        return 0;
+    for (int r = 0; r < blk->num_rows; r++)
+    {
+        const void *row = matrix_row(m, blk->row_start + r);
+        for (int c = blk->col_start; c < blk->col_start + blk->num_cols; c++)
+        {
+            int v = (m->dtype == DTYPE_INT8)    ? ((const int8_t *)row)[c]
+                    : (m->dtype == DTYPE_INT16) ? ((const int16_t *)row)[c]
+                                                : ((const int32_t *)row)[c];
+            if (v < lo || v > hi)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to print a matrix
+void matrix_print(const Matrix *m)
+{
+    for (int i = 0; i < m->rows; i++)
+    {
+        const void *row = matrix_row(m, i);
+        for (int j = 0; j < m->cols; j++)
+        {
+            switch (m->dtype)
+            {
+            case DTYPE_INT8:
+                printf("%d ", ((const int8_t *)row)[j]);
+                break;
+            case DTYPE_INT16:
+                printf("%d ", ((const int16_t *)row)[j]);
+                break;
+            case DTYPE_INT32:
+                printf("%d ", ((const int32_t *)row)[j]);
+                break;
+            case DTYPE_FLOAT:
+                printf("%g ", ((const float *)row)[j]);
+                break;
+            case DTYPE_DOUBLE:
+                printf("%g ", ((const double *)row)[j]);
+                break;
+            }
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,161 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Element types a matrix can be stored in
+typedef enum
+{
+    DTYPE_INT8,
+    DTYPE_INT16,
+    DTYPE_INT32,
+    DTYPE_FLOAT,
+    DTYPE_DOUBLE
+} ElemType;
+
+// Contiguous row-major matrix shared by master and slave
+// All rows live in one allocation, so any range of rows is a single span
+// that can be sent or received with one call
+typedef struct
+{
+    int rows;  // number of rows
+    int cols;  // number of columns
+    ElemType dtype; // type of the elements
+    void *data;     // rows * cols elements, row-major
+    size_t mapped;  // bytes mapped by matrix_alloc_placed or a matrix file, 0 when malloc'ed
+    int fd;         // matrix file backing data, -1 if none
+    size_t file_offset; // offset of data in the file (and in the mapping)
+} Matrix;
+
+// Matrix files: a header of MATRIX_FILE_HEADER_SIZE bytes, padded to
+// MATRIX_FILE_DATA_OFFSET, then the elements row-major in the byte order of the
+// machine that wrote them, so the payload can be mapped and sent as it is
+// A file holds a whole matrix, or a block of one (row_start, col_start)
+#define MATRIX_FILE_MAGIC 0x4D30424Cu   // "LB0M" as written by a little-endian machine
+#define MATRIX_FILE_VERSION 1
+#define MATRIX_FILE_DATA_OFFSET 4096    // payload starts on a page boundary
+#define MATRIX_SEED_NONE UINT64_MAX      // the matrix was not generated from a seed
+
+// Description of a matrix file
+typedef struct
+{
+    int rows;
+    int cols;
+    ElemType dtype;
+    int row_start; // position of the block in the full matrix
+    int col_start;
+    uint64_t seed; // seed the matrix was generated from, MATRIX_SEED_NONE if unknown
+} MatrixFileInfo;
+
+// Rectangular region of a matrix
+typedef struct
+{
+    int row_start;
+    int num_rows;
+    int col_start;
+    int num_cols;
+} MatrixBlock;
+
+// Allocates a rows x cols matrix of dtype elements in a single block
+// Returns 0 on success, -1 if the allocation failed
+int matrix_alloc(Matrix *m, int rows, int cols, ElemType dtype);
+
+// Allocates a rows x cols matrix whose pages are placed on NUMA nodes by first touch:
+// the rows of ranges[i] are first written by a thread pinned to cpus[i], so they
+// land on the node of the thread that will later read them
+// Returns 0 on success, -1 if the allocation failed
+int matrix_alloc_placed(Matrix *m, int rows, int cols, ElemType dtype, const MatrixBlock *ranges, const int *cpus,
+                        int count);
+
+// Reads the header of a matrix file
+// Returns 0 on success, 1 if the file does not exist, -1 if it is not a valid matrix file
+int matrix_file_info(const char *path, MatrixFileInfo *info);
+
+// Maps an existing matrix file read-only
+// Returns 0 on success, -1 on error
+int matrix_map_file(Matrix *m, const char *path, MatrixFileInfo *info);
+
+// Creates (or truncates) a matrix file described by info and maps it read-write;
+// the elements are written through the mapping and reach the file as pages are flushed
+// Returns 0 on success, -1 on error
+int matrix_create_file(Matrix *m, const char *path, const MatrixFileInfo *info);
+
+// Function to open the matrix file at path for a matrix described by want
+// An existing file is mapped read-only and must have want's shape and dtype;
+// a missing one is created, and *created is set so the caller fills it
+// Returns 0 on success, -1 on error
+int matrix_open_file(Matrix *m, const char *path, const MatrixFileInfo *want, int *created);
+
+// Releases the storage of a matrix and resets it to empty
+void matrix_free(Matrix *m);
+
+// Fills the matrix with pseudo-random values from 1 to 9 drawn from seed: integers
+// for the integer types, reals in [1, 10) for float and double
+// Element (i, j) is drawn from element number i * cols + j of the stream, so the result does
+// not depend on the number of threads (0 = one per online CPU) that fill the rows
+void matrix_fill_seeded(Matrix *m, uint64_t seed, int threads);
+
+// Fills rows [first, first + count) of m, which holds the region blk of an
+// n-column matrix filled from seed, with the same values that matrix has there
+void matrix_fill_seeded_block(Matrix *m, uint64_t seed, int n, const MatrixBlock *blk, int first, int count);
+
+// Checks that every element of the region blk of m is an integer in [lo, hi]
+// Returns 1 if they all are, 0 otherwise (always 0 for float and double)
+int matrix_block_in_range(const Matrix *m, const MatrixBlock *blk, int lo, int hi);
+
+// Prints the matrix (only meant for small matrices)
+void matrix_print(const Matrix *m);
+
+// SplitMix64 finalizer: scrambles the bits of x
+static inline uint64_t matrix_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Returns element number index (1 to 9) of the stream drawn from seed
+// Counter-based SplitMix64: any element is computed on its own, without the ones before it
+static inline int matrix_seeded_value(uint64_t seed, uint64_t index)
+{
+    uint64_t x = matrix_mix(seed + (index + 1) * 0x9e3779b97f4a7c15ULL);
+    return (int)(((x >> 32) * 9) >> 32) + 1;
+}
+
+// Returns element number index of the stream drawn from seed as a real in [1, 10)
+static inline double matrix_seeded_real(uint64_t seed, uint64_t index)
+{
+    uint64_t x = matrix_mix(seed + (index + 1) * 0x9e3779b97f4a7c15ULL);
+    return 1.0 + 9.0 * (double)(x >> 11) * (1.0 / 9007199254740992.0); // 53 random bits
+}
+
+// Returns the size in bytes of one element of type t
+static inline size_t dtype_size(ElemType t)
+{
+    static const size_t sizes[] = {1, 2, 4, 4, 8};
+    return sizes[t];
+}
+
+// Returns 1 for float and double, 0 for the integer types
+static inline int dtype_is_real(ElemType t)
+{
+    return t == DTYPE_FLOAT || t == DTYPE_DOUBLE;
+}
+
+// Returns the name of an element type
+const char *dtype_name(ElemType t);
+
+// Returns a pointer to the first element of row i
+static inline void *matrix_row(const Matrix *m, int i)
+{
+    return (char *)m->data + (size_t)i * m->cols * dtype_size(m->dtype);
+}
+
+// Returns the number of bytes spanned by num_rows consecutive rows
+static inline size_t matrix_block_bytes(const Matrix *m, int num_rows)
+{
+    return (size_t)num_rows * m->cols * dtype_size(m->dtype);
+}
+
+#endif
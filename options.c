@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include "options.h"
+#include "protocol.h"
+
+// Function to set every option to its default
+void options_init(Options *opts)
+{
+    opts->chunk_rows = 0;
+    opts->jobs = 1;
+    opts->event_loops = 0;
+    opts->persistent = 0;
+    opts->weights = WEIGHTS_CONFIG;
+    opts->layout = LAYOUT_ROWS;
+    opts->probe_rows = 64;
+    opts->schedule = SCHEDULE_STATIC;
+    opts->sched_rows = 0;
+    opts->kernel = KERNEL_NONE;
+    opts->simd = SIMD_AUTO;
+    opts->slave_threads = 1;
+    opts->affinity = AFFINITY_NONE;
+    opts->nic[0] = '\0';
+    opts->cpu_slot = -1;
+    opts->seed = -1;
+    opts->payload = PAYLOAD_DATA;
+    opts->encoding = ENCODING_RAW;
+    opts->dtype = DTYPE_INT32;
+    opts->matrix_file[0] = '\0';
+    opts->output_dir[0] = '\0';
+    opts->broadcast = BROADCAST_DIRECT;
+    opts->reduce = REDUCE_DIRECT;
+    opts->socket = *transfer_profile(); // built-in default, TCP_NODELAY only
+    opts->sweep = 0;
+    opts->streams = 1;
+}
+
+// Function to parse an integer value within [min, max]
+static int parse_int(const char *key, const char *value, long min, long max, int *out)
+{
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || v < min || v > max)
+    {
+        fprintf(stderr, "Invalid value '%s' for option %s\n", value, key);
+        return -1;
+    }
+    *out = (int)v;
+    return 0;
+}
+
+// Function to copy a string value into a fixed-size field
+static int parse_string(const char *key, const char *value, char *out, size_t size)
+{
+    if (strlen(value) >= size)
+    {
+        fprintf(stderr, "Invalid value '%s' for option %s\n", value, key);
+        return -1;
+    }
+    strcpy(out, value);
+    return 0;
+}
+
+// Function to parse a seed, any non-negative 64-bit integer
+static int parse_seed(const char *key, const char *value, long long *out)
+{
+    char *end;
+    errno = 0;
+    long long v = strtoll(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || errno != 0 || v < 0)
+    {
+        fprintf(stderr, "Invalid value '%s' for option %s\n", value, key);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+// Function to parse a value that must be one of a list of names
+// Stores the index of the matching name in *out
+static int parse_choice(const char *key, const char *value, const char *const choices[], int count, int *out)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(value, choices[i]) == 0)
+        {
+            *out = i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Invalid value '%s' for option %s\n", value, key);
+    return -1;
+}
+
+// Function to set one option by name
+// Dashes and underscores are interchangeable in option names
+int options_set(Options *opts, const char *key, const char *value)
+{
+    char name[64];
+    size_t k;
+    for (k = 0; key[k] != '\0' && k < sizeof(name) - 1; k++)
+    {
+        name[k] = (key[k] == '-') ? '_' : key[k];
+    }
+    name[k] = '\0';
+
+    if (strcmp(name, "chunk_rows") == 0)
+        return parse_int(key, value, 0, 1000000000L, &opts->chunk_rows);
+    if (strcmp(name, "jobs") == 0)
+        return parse_int(key, value, 1, 1000000L, &opts->jobs);
+    if (strcmp(name, "event_loops") == 0)
+        return parse_int(key, value, 0, 1024, &opts->event_loops);
+    if (strcmp(name, "persistent") == 0)
+        return parse_int(key, value, 0, 1, &opts->persistent);
+    if (strcmp(name, "probe_rows") == 0)
+        return parse_int(key, value, 1, 1000000L, &opts->probe_rows);
+    if (strcmp(name, "slave_threads") == 0)
+        return parse_int(key, value, 1, 1024, &opts->slave_threads);
+    if (strcmp(name, "sched_rows") == 0)
+        return parse_int(key, value, 0, 1000000000L, &opts->sched_rows);
+    if (strcmp(name, "seed") == 0)
+        return parse_seed(key, value, &opts->seed);
+    if (strcmp(name, "cpu_slot") == 0)
+        return parse_int(key, value, -1, 1024, &opts->cpu_slot);
+    if (strcmp(name, "nic") == 0)
+        return parse_string(key, value, opts->nic, sizeof(opts->nic));
+    if (strcmp(name, "matrix_file") == 0)
+        return parse_string(key, value, opts->matrix_file, sizeof(opts->matrix_file));
+    if (strcmp(name, "output_dir") == 0)
+        return parse_string(key, value, opts->output_dir, sizeof(opts->output_dir));
+    if (strcmp(name, "sndbuf") == 0)
+        return parse_int(key, value, 0, 1L << 30, &opts->socket.sndbuf);
+    if (strcmp(name, "rcvbuf") == 0)
+        return parse_int(key, value, 0, 1L << 30, &opts->socket.rcvbuf);
+    if (strcmp(name, "nodelay") == 0)
+        return parse_int(key, value, 0, 1, &opts->socket.nodelay);
+    if (strcmp(name, "cork") == 0)
+        return parse_int(key, value, 0, 1, &opts->socket.cork);
+    if (strcmp(name, "busy_poll") == 0)
+        return parse_int(key, value, 0, 1000000L, &opts->socket.busy_poll);
+    if (strcmp(name, "zerocopy") == 0)
+        return parse_int(key, value, 0, 1, &opts->socket.zerocopy);
+    if (strcmp(name, "sweep") == 0)
+        return parse_int(key, value, 0, 1, &opts->sweep);
+    if (strcmp(name, "streams") == 0)
+        return parse_int(key, value, 1, PROTO_MAX_STREAMS, &opts->streams);
+
+    int choice;
+    if (strcmp(name, "weights") == 0)
+    {
+        static const char *const names[] = {"equal", "config", "probe"};
+        if (parse_choice(key, value, names, 3, &choice) != 0)
+            return -1;
+        opts->weights = (WeightSource)choice;
+        return 0;
+    }
+    if (strcmp(name, "layout") == 0)
+    {
+        static const char *const names[] = {"rows", "cols", "2d"};
+        if (parse_choice(key, value, names, 3, &choice) != 0)
+            return -1;
+        opts->layout = (PartitionLayout)choice;
+        return 0;
+    }
+    if (strcmp(name, "schedule") == 0)
+    {
+        static const char *const names[] = {"static", "dynamic"};
+        if (parse_choice(key, value, names, 2, &choice) != 0)
+            return -1;
+        opts->schedule = (ScheduleMode)choice;
+        return 0;
+    }
+    if (strcmp(name, "kernel") == 0)
+    {
+        static const char *const names[] = {"none", "matvec", "rowsum", "colsum", "pearson"};
+        if (parse_choice(key, value, names, 5, &choice) != 0)
+            return -1;
+        opts->kernel = (KernelKind)choice;
+        return 0;
+    }
+    if (strcmp(name, "simd") == 0)
+    {
+        static const char *const names[] = {"auto", "scalar", "avx2", "avx512"};
+        if (parse_choice(key, value, names, 4, &choice) != 0)
+            return -1;
+        opts->simd = (SimdLevel)choice;
+        return 0;
+    }
+    if (strcmp(name, "payload") == 0)
+    {
+        static const char *const names[] = {"data", "seed"};
+        if (parse_choice(key, value, names, 2, &choice) != 0)
+            return -1;
+        opts->payload = (PayloadMode)choice;
+        return 0;
+    }
+    if (strcmp(name, "dtype") == 0)
+    {
+        static const char *const names[] = {"int8", "int16", "int32", "float", "double"};
+        if (parse_choice(key, value, names, 5, &choice) != 0)
+            return -1;
+        opts->dtype = (ElemType)choice;
+        return 0;
+    }
+    if (strcmp(name, "encoding") == 0)
+    {
+        static const char *const names[] = {"raw", "pack4"};
+        if (parse_choice(key, value, names, 2, &choice) != 0)
+            return -1;
+        opts->encoding = (TileEncoding)choice;
+        return 0;
+    }
+    if (strcmp(name, "broadcast") == 0)
+    {
+        static const char *const names[] = {"direct", "tree", "chain"};
+        if (parse_choice(key, value, names, 3, &choice) != 0)
+            return -1;
+        opts->broadcast = (BroadcastMode)choice;
+        return 0;
+    }
+    if (strcmp(name, "reduce") == 0)
+    {
+        static const char *const names[] = {"direct", "tree", "chain"};
+        if (parse_choice(key, value, names, 3, &choice) != 0)
+            return -1;
+        opts->reduce = (ReduceMode)choice;
+        return 0;
+    }
+    if (strcmp(name, "affinity") == 0)
+    {
+        static const char *const names[] = {"none", "compact", "scatter", "nic"};
+        if (parse_choice(key, value, names, 4, &choice) != 0)
+            return -1;
+        opts->affinity = (AffinityPolicy)choice;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown option %s\n", key);
+    return -1;
+}
+
+// Function to parse option flags from the command line
+int options_parse_args(Options *opts, int argc, char *argv[], int first)
+{
+    for (int i = first; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            fprintf(stderr, "Unexpected argument %s\n", argv[i]);
+            return -1;
+        }
+
+        char key[64];
+        const char *arg = argv[i] + 2;
+        const char *eq = strchr(arg, '=');
+        const char *value;
+
+        if (eq != NULL) // --key=value
+        {
+            size_t len = (size_t)(eq - arg) < sizeof(key) - 1 ? (size_t)(eq - arg) : sizeof(key) - 1;
+            memcpy(key, arg, len);
+            key[len] = '\0';
+            value = eq + 1;
+        }
+        else // --key value
+        {
+            snprintf(key, sizeof(key), "%s", arg);
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Missing value for option %s\n", argv[i]);
+                return -1;
+            }
+            value = argv[++i];
+        }
+
+        if (options_set(opts, key, value) != 0)
+            return -1;
+    }
+
+    if (opts->encoding == ENCODING_PACK4 && dtype_is_real(opts->dtype))
+    {
+        fprintf(stderr, "Encoding pack4 needs an integer dtype\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to take the dtype and seed of the run from an existing matrix file
+int options_apply_matrix_file(Options *opts)
+{
+    MatrixFileInfo info;
+    int rc = (opts->matrix_file[0] != '\0') ? matrix_file_info(opts->matrix_file, &info) : 1;
+    if (rc != 0)
+        return (rc < 0) ? -1 : 0;
+
+    opts->dtype = info.dtype;
+    if (info.seed <= (uint64_t)LLONG_MAX)
+    {
+        opts->seed = (long long)info.seed;
+    }
+    else if (opts->payload == PAYLOAD_SEED)
+    {
+        fprintf(stderr, "%s was not generated from a seed, its blocks must be sent as data\n", opts->matrix_file);
+        return -1;
+    }
+    if (opts->encoding == ENCODING_PACK4 && dtype_is_real(opts->dtype))
+    {
+        fprintf(stderr, "Encoding pack4 needs an integer dtype\n");
+        return -1;
+    }
+
+    // A file is not limited to the values the generator draws, so it is
+    // scanned once for any that pack4 cannot carry
+    if (opts->encoding == ENCODING_PACK4)
+    {
+        Matrix m;
+        if (matrix_map_file(&m, opts->matrix_file, &info) != 0)
+            return -1;
+        MatrixBlock all = {0, m.rows, 0, m.cols};
+        int fits = matrix_block_in_range(&m, &all, 0, 15);
+        matrix_free(&m);
+        if (!fits)
+        {
+            fprintf(stderr, "%s holds values outside 0-15, encoding pack4 cannot carry them\n", opts->matrix_file);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to print the accepted options
+void options_usage(void)
+{
+    printf("Options (also accepted as \"key value\" lines in the config file):\n");
+    printf("  --chunk-rows K: stream each block in tiles of K rows (0 = whole block)\n");
+    printf("  --jobs J: master runs J jobs over the same slave connections\n");
+    printf("  --event-loops L: master drives all slaves from L epoll threads instead of one thread each\n");
+    printf("  --persistent 1: slave keeps serving jobs and connections until killed\n");
+    printf("  --weights equal|config|probe: master splits the matrix evenly, by config weight or by measured speed\n");
+    printf("  --layout rows|cols|2d: master gives each slave a row range, a column range or a grid cell\n");
+    printf("  --probe-rows R: rows sent to each slave when weights are probed\n");
+    printf("  --schedule static|dynamic: core-affine master sends fixed blocks, or row tiles that idle slaves steal\n");
+    printf("  --sched-rows R: rows per dynamic tile (0 = about 8 tiles per slave)\n");
+    printf("  --kernel none|matvec|rowsum|colsum|pearson: computation the slaves run, gathered by the master\n");
+    printf("  --simd auto|scalar|avx2|avx512: instruction set of the slave kernels (auto = best the CPU has)\n");
+    printf("  --slave-threads T: slave computes with T worker threads, one per core\n");
+    printf("  --seed S: master generates the matrix from seed S, so runs can be repeated (default: the clock)\n");
+    printf("  --payload data|seed: master ships the blocks, or only the seed for the slaves to regenerate them\n");
+    printf("  --dtype int8|int16|int32|float|double: element type the matrix is stored and sent in\n");
+    printf("  --matrix-file PATH: master maps the matrix from PATH, generating it there first when missing;\n");
+    printf("      an existing file sets the dtype and seed of the run\n");
+    printf("  --output-dir DIR: slave writes every received block to DIR as a matrix file\n");
+    printf("  --encoding raw|pack4: master sends elements in the matrix dtype, or 4 bits each for integer values 0-15\n");
+    printf("  --broadcast direct|tree|chain: master sends the kernel vector to every slave, or once for the\n");
+    printf("      slaves to forward along a binomial tree or a chain (static schedule; same config on every node)\n");
+    printf("  --reduce direct|tree|chain: slaves reply with their results, or sum them up a binomial tree\n");
+    printf("      or a chain for slave 0 to reply with the total (static schedule; same config on every node)\n");
+    printf("  --sndbuf B, --rcvbuf B: socket buffer sizes in bytes (0 = kernel default, autotuned)\n");
+    printf("  --nodelay 0|1: send headers and replies at once (TCP_NODELAY, default 1)\n");
+    printf("  --cork 0|1: cork each block so it leaves in full segments (TCP_CORK)\n");
+    printf("  --busy-poll US: microseconds a blocking receive busy-polls the device (SO_BUSY_POLL, 0 = off)\n");
+    printf("  --zerocopy 0|1: send matrix data with MSG_ZEROCOPY (blocking senders, raw in-memory tiles)\n");
+    printf("  --sweep 0|1: master runs the jobs once per socket profile and reports the throughput of each\n");
+    printf("      (master side only, slaves keep their own profile and must run with --persistent 1)\n");
+    printf("  --streams S: master stripes each slave's blocks over S parallel TCP streams (1-16, default 1;\n");
+    printf("      a fifth column \"host port slave weight streams\" sets it per slave; --event-loops keep one stream)\n");
+    printf("  --affinity none|compact|scatter|nic: placement of the threads on the CPUs (core-affine default compact)\n");
+    printf("  --nic IFACE: interface whose NUMA node the nic policy prefers (default: the default route's)\n");
+    printf("  --cpu-slot S: slave's index among the slaves of its host (-1 = its position in the config)\n");
+}
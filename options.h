@@ -0,0 +1,139 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "matrix.h"
+#include "transfer.h"
+
+// Where the master takes per-slave capacity weights from
+typedef enum
+{
+    WEIGHTS_EQUAL,  // every slave gets the same share
+    WEIGHTS_CONFIG, // weight column of the config file (1 when omitted)
+    WEIGHTS_PROBE   // measured by timing a probe block on every slave
+} WeightSource;
+
+// How the matrix is cut into one block per slave
+typedef enum
+{
+    LAYOUT_ROWS, // contiguous row ranges
+    LAYOUT_COLS, // contiguous column ranges
+    LAYOUT_2D    // grid of rectangles
+} PartitionLayout;
+
+// How the master hands out the work of a job
+typedef enum
+{
+    SCHEDULE_STATIC, // one fixed block per slave
+    SCHEDULE_DYNAMIC // row tiles pulled (and stolen) by the slaves as they finish
+} ScheduleMode;
+
+// Computation the slaves run over their blocks
+typedef enum
+{
+    KERNEL_NONE,   // receive and acknowledge only
+    KERNEL_MATVEC, // M x for a broadcast vector x
+    KERNEL_ROWSUM, // sum of every row
+    KERNEL_COLSUM, // sum of every column
+    KERNEL_PEARSON // correlation of every column with a broadcast vector y
+} KernelKind;
+
+// Instruction set of the slave kernels
+typedef enum
+{
+    SIMD_AUTO,   // best one the CPU supports
+    SIMD_SCALAR, // plain C
+    SIMD_AVX2,
+    SIMD_AVX512
+} SimdLevel;
+
+// Placement of the master's sender threads and the slave's threads on the CPUs
+typedef enum
+{
+    AFFINITY_NONE,    // left to the scheduler
+    AFFINITY_COMPACT, // SMT siblings first, then neighbouring cores
+    AFFINITY_SCATTER, // one thread per physical core across the nodes first
+    AFFINITY_NIC      // cores of the network card's NUMA node first
+} AffinityPolicy;
+
+// What the master sends for the matrix
+typedef enum
+{
+    PAYLOAD_DATA, // the elements of every block
+    PAYLOAD_SEED  // only the seed; the slaves regenerate their blocks
+} PayloadMode;
+
+// Encoding of the tiles on the wire (same numbering as PROTO_ENC_*)
+typedef enum
+{
+    ENCODING_RAW,  // elements in the block's dtype
+    ENCODING_PACK4 // 4 bits per element; the generated matrix only holds 1 to 9
+} TileEncoding;
+
+// How the master gets the kernel vector to the slaves
+typedef enum
+{
+    BROADCAST_DIRECT, // the master sends every slave its slice
+    BROADCAST_TREE,   // the master sends it once, the slaves forward it along a binomial tree
+    BROADCAST_CHAIN   // the master sends it once, each slave forwards it to the next
+} BroadcastMode;
+
+// How the slaves' results get back to the master
+typedef enum
+{
+    REDUCE_DIRECT, // every slave replies with the results of its block
+    REDUCE_TREE,   // the slaves sum them up a binomial tree, slave 0 replies with the total
+    REDUCE_CHAIN   // the slaves sum them up a chain, slave 0 replies with the total
+} ReduceMode;
+
+// Tunable run options
+// Read from "key value" lines in the config file, then overridden by
+// "--key value" (or "--key=value") flags after the positional arguments
+typedef struct
+{
+    int chunk_rows;  // rows per streamed tile, 0 sends each block as one tile
+    int jobs;        // master: jobs to run over the same connections
+    int event_loops; // master: epoll event loop threads driving all slaves, 0 = one thread per slave
+    int persistent;  // slave: 1 to keep serving jobs instead of exiting after one
+    WeightSource weights;   // master: source of the per-slave capacity weights
+    PartitionLayout layout; // master: shape of the per-slave blocks
+    int probe_rows;         // master: rows in the probe block when weights are probed
+    ScheduleMode schedule;  // master: static blocks or dynamic row tiles
+    int sched_rows;         // master: rows per dynamic tile, 0 = about 8 tiles per slave
+    KernelKind kernel;      // master: computation the slaves run, results are gathered back
+    SimdLevel simd;         // slave: instruction set of the kernels
+    int slave_threads;      // slave: worker threads running the kernels, 1 = compute on the receiving thread
+    AffinityPolicy affinity; // placement of the threads on the CPUs
+    char nic[32];            // network interface for the nic policy, "" = the default route's
+    int cpu_slot;            // slave: index among the slaves of this host, -1 = from the config
+    long long seed;          // master: seed of the generated matrix and vector, -1 = from the clock
+    PayloadMode payload;     // master: ship the matrix data or only its seed
+    TileEncoding encoding;   // master: encoding of the tiles on the wire
+    ElemType dtype;          // master: element type the matrix is stored and sent in
+    char matrix_file[256];   // master: matrix file to map, created from the seed when missing, "" = in memory
+    char output_dir[256];    // slave: directory the received blocks are written to as matrix files, "" = memory only
+    BroadcastMode broadcast; // master: how the kernel vector reaches the slaves
+    ReduceMode reduce;       // master: how the results get back from the slaves
+    SocketProfile socket;    // socket options of the data connections (sndbuf, rcvbuf, nodelay, cork, busy-poll, zerocopy)
+    int sweep;               // master: 1 to run the jobs once per profile of the socket sweep and compare throughput
+    int streams;             // master: TCP streams to every slave its blocks are striped over (a slave's config column overrides it)
+} Options;
+
+// Sets every option to its default
+void options_init(Options *opts);
+
+// Sets one option by name (dashes and underscores are interchangeable)
+// Returns 0 on success, -1 on an unknown option or invalid value
+int options_set(Options *opts, const char *key, const char *value);
+
+// Parses the option flags in argv[first..argc-1], then checks the options fit together
+// Returns 0 on success, -1 on an unknown flag, an invalid value or conflicting options
+int options_parse_args(Options *opts, int argc, char *argv[], int first);
+
+// Takes the dtype and seed of the run from the matrix file, when it already exists
+// Returns 0 on success (or no file yet), -1 on an unreadable file or conflicting options
+int options_apply_matrix_file(Options *opts);
+
+// Prints the list of accepted options
+void options_usage(void);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "protocol.h"
+#include "partition.h"
+
+// Function to split [0, total) into count contiguous ranges proportional to w[]
+// Boundaries are rounded from the cumulative weight, so rounding errors never add up
+// Ranges whose weights are all 0 (slaves that could not be probed) split evenly
+void partition_split(int total, int count, const double w[], int start[], int len[])
+{
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += w[i];
+    }
+
+    double acc = 0;
+    int prev = 0;
+    for (int i = 0; i < count; i++)
+    {
+        acc += (sum > 0) ? w[i] : 1;
+        int end = (i == count - 1) ? total : (int)llround(total * (acc / (sum > 0 ? sum : count)));
+        if (end < prev)
+            end = prev;
+        if (end > total)
+            end = total;
+        start[i] = prev;
+        len[i] = end - prev;
+        prev = end;
+    }
+}
+
+// Function to time one probe block on a slave
+// Returns the weight (elements per second), or -1 on failure
+static double probe_slave(int fd, const Matrix *M, int probe_rows, int chunk_rows, TransferStats *stats)
+{
+    MatrixBlock blk = {0, probe_rows < M->rows ? probe_rows : M->rows, 0, M->cols};
+    BlockReply reply;
+
+    struct timespec time_before, time_after;
+    clock_gettime(CLOCK_MONOTONIC, &time_before);
+
+    if (proto_send_block(fd, M, &blk, NULL, chunk_rows, PROTO_FLAG_PROBE, stats) != 0 ||
+        proto_recv_reply(fd, &reply, stats) != 0 || reply.status != PROTO_STATUS_OK)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &time_after);
+    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
+                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
+    if (elapsed_time <= 0)
+        elapsed_time = 1e-9;
+
+    return (double)blk.num_rows * blk.num_cols / elapsed_time;
+}
+
+// Function to fill in the capacity weight of every slave
+void partition_weights(ConnPool *pool, const Options *opts, const Matrix *M, TransferStats stats[],
+                       double weights[])
+{
+    for (int s = 0; s < pool->num_slaves; s++)
+    {
+        weights[s] = (opts->weights == WEIGHTS_EQUAL) ? 1.0 : pool->slaves[s].weight;
+    }
+    if (opts->weights != WEIGHTS_PROBE)
+        return;
+
+    // Probe one slave at a time so they do not compete for the master's link
+    // Slaves the pool could not reach are skipped rather than connected here
+    // A probed weight is in elements per second, so a slave without one gets
+    // weight 0 (no block) instead of a config weight in other units
+    int probed = 0;
+    for (int s = 0; s < pool->num_slaves; s++)
+    {
+        weights[s] = 0;
+        if (pool->fds[s] < 0)
+            continue;
+
+        double w = probe_slave(pool->fds[s], M, opts->probe_rows, opts->chunk_rows, &stats[s]);
+        if (w < 0)
+        {
+            perror("Probing slave failed");
+            connpool_close(pool, s);
+            continue;
+        }
+        weights[s] = w;
+        probed++;
+    }
+
+    // With no probe to go by, the config weights are all there is
+    if (probed == 0)
+    {
+        for (int s = 0; s < pool->num_slaves; s++)
+        {
+            weights[s] = pool->slaves[s].weight;
+        }
+    }
+}
+
+// Function to split the matrix into one block per slave
+void partition_blocks(int n, int num_slaves, const double weights[], PartitionLayout layout, MatrixBlock blocks[])
+{
+    int *start = (int *)malloc(num_slaves * sizeof(int));
+    int *len = (int *)malloc(num_slaves * sizeof(int));
+
+    if (layout == LAYOUT_ROWS || layout == LAYOUT_COLS)
+    {
+        partition_split(n, num_slaves, weights, start, len);
+        for (int s = 0; s < num_slaves; s++)
+        {
+            MatrixBlock rows = {start[s], len[s], 0, n};
+            MatrixBlock cols = {0, n, start[s], len[s]};
+            blocks[s] = (layout == LAYOUT_ROWS) ? rows : cols;
+        }
+    }
+    else
+    {
+        // Grid of bands x cells: bands are row ranges sized by the total weight
+        // of their slaves, and each band is cut into column ranges by weight
+        int bands = (int)sqrt((double)num_slaves);
+        if (bands < 1)
+            bands = 1;
+
+        double *band_weight = (double *)calloc(bands, sizeof(double));
+        int *band_first = (int *)malloc((bands + 1) * sizeof(int));
+        for (int b = 0; b <= bands; b++)
+        {
+            band_first[b] = (int)((long)num_slaves * b / bands);
+        }
+        for (int b = 0; b < bands; b++)
+        {
+            for (int s = band_first[b]; s < band_first[b + 1]; s++)
+            {
+                band_weight[b] += weights[s];
+            }
+        }
+
+        int *band_start = (int *)malloc(bands * sizeof(int));
+        int *band_len = (int *)malloc(bands * sizeof(int));
+        partition_split(n, bands, band_weight, band_start, band_len);
+
+        for (int b = 0; b < bands; b++)
+        {
+            int first = band_first[b];
+            int count = band_first[b + 1] - first;
+            partition_split(n, count, weights + first, start + first, len + first);
+            for (int s = first; s < first + count; s++)
+            {
+                MatrixBlock cell = {band_start[b], band_len[b], start[s], len[s]};
+                blocks[s] = cell;
+            }
+        }
+
+        free(band_weight);
+        free(band_first);
+        free(band_start);
+        free(band_len);
+    }
+
+    free(start);
+    free(len);
+}
+
+// Function to print the block assigned to every slave
+void partition_print(int num_slaves, const double weights[], const MatrixBlock blocks[])
+{
+    for (int s = 0; s < num_slaves; s++)
+    {
+        if (weights[s] == 0) // config weights are positive, only a failed probe leaves 0
+        {
+            printf("Slave %d: weight 0 (not probed), no block\n", s);
+            continue;
+        }
+        printf("Slave %d: weight %g, rows %d-%d, columns %d-%d\n", s, weights[s],
+               blocks[s].row_start, blocks[s].row_start + blocks[s].num_rows - 1,
+               blocks[s].col_start, blocks[s].col_start + blocks[s].num_cols - 1);
+    }
+}
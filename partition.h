@@ -0,0 +1,38 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "matrix.h"
+#include "transfer.h"
+#include "options.h"
+#include "connpool.h"
+
+// Partitioning of the matrix into one block per slave
+//
+// Every slave gets a share of the matrix proportional to its capacity weight,
+// so faster (or better connected) slaves get larger blocks and all of them
+// finish at about the same time
+// Blocks are contiguous row ranges, column ranges, or the cells of a grid
+// whose bands and cells are sized by the weights they contain
+
+// Fills weights[] with the capacity weight of every slave, as selected by opts->weights
+// For WEIGHTS_PROBE a probe block of opts->probe_rows rows of M is timed on every
+// slave over its connection in pool, which is left open for the jobs
+// Slaves that cannot be probed get weight 0, and so no block, unless none can,
+// in which case all keep their config weight; a connection that fails the
+// probe is closed with all its streams, for the next prepare to replace
+void partition_weights(ConnPool *pool, const Options *opts, const Matrix *M, TransferStats stats[],
+                       double weights[]);
+
+// Splits [0, total) into count contiguous ranges, range i starting at start[i]
+// and holding len[i] items, in proportion to w[i]
+void partition_split(int total, int count, const double w[], int start[], int len[]);
+
+// Splits an n x n matrix into num_slaves blocks according to layout, block s
+// being proportional to weights[s]
+// Blocks may be empty when a weight is tiny compared to the others
+void partition_blocks(int n, int num_slaves, const double weights[], PartitionLayout layout, MatrixBlock blocks[]);
+
+// Prints the block assigned to every slave
+void partition_print(int num_slaves, const double weights[], const MatrixBlock blocks[]);
+
+#endif
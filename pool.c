@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "pool.h"
+
+// Structure handed to each worker thread
+typedef struct
+{
+    WorkerPool *pool;
+    int worker; // Index of the worker
+    int cpu;    // core to pin to, -1 for none
+} PoolWorkerArgs;
+
+// Thread function of a worker: run grains until the pool stops
+static void *pool_worker(void *arg)
+{
+    PoolWorkerArgs args = *(PoolWorkerArgs *)arg;
+    WorkerPool *p = args.pool;
+    free(arg);
+
+    if (args.cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(args.cpu, &cpuset);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        while (p->size == 0 && !p->stopping)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->size == 0)
+            break; // stopping and nothing left
+
+        PoolItem item = p->queue[p->head];
+        p->head = (p->head + 1) % p->capacity;
+        p->size--;
+
+        pthread_mutex_unlock(&p->lock);
+        item.fn(item.ctx, args.worker, item.first, item.count);
+        pthread_mutex_lock(&p->lock);
+
+        if (--p->pending == 0)
+            pthread_cond_broadcast(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Function to start the worker threads
+int pool_start(WorkerPool *p, int num_workers, const int *cpus)
+{
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    p->num_workers = 0;
+    p->capacity = 64;
+    p->head = 0;
+    p->size = 0;
+    p->pending = 0;
+    p->stopping = 0;
+    p->queue = (PoolItem *)malloc(p->capacity * sizeof(PoolItem));
+    p->threads = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+    if (p->queue == NULL || p->threads == NULL)
+    {
+        perror("Pool allocation failed");
+        pool_stop(p);
+        return -1;
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        PoolWorkerArgs *args = (PoolWorkerArgs *)malloc(sizeof(PoolWorkerArgs));
+        args->pool = p;
+        args->worker = w;
+        args->cpu = cpus ? cpus[w] : -1;
+        if (pthread_create(&p->threads[w], NULL, pool_worker, args) != 0)
+        {
+            perror("Worker creation failed");
+            free(args);
+            pool_stop(p);
+            return -1;
+        }
+        p->num_workers++;
+    }
+    return 0;
+}
+
+// Function to queue a range of items in grains
+void pool_submit(WorkerPool *p, PoolTask fn, void *ctx, int first, int count, int grain)
+{
+    if (grain < 1)
+        grain = 1;
+
+    pthread_mutex_lock(&p->lock);
+    for (int k = first; k < first + count; k += grain)
+    {
+        // Grow the circular queue, unrolling it into the new buffer
+        if (p->size == p->capacity)
+        {
+            PoolItem *bigger = (PoolItem *)malloc(2 * p->capacity * sizeof(PoolItem));
+            for (int i = 0; i < p->size; i++)
+            {
+                bigger[i] = p->queue[(p->head + i) % p->capacity];
+            }
+            free(p->queue);
+            p->queue = bigger;
+            p->capacity *= 2;
+            p->head = 0;
+        }
+
+        PoolItem item = {fn, ctx, k, (first + count - k < grain) ? first + count - k : grain};
+        p->queue[(p->head + p->size) % p->capacity] = item;
+        p->size++;
+        p->pending++;
+    }
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Function to wait until every submitted grain has run
+void pool_wait(WorkerPool *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->pending > 0)
+        pthread_cond_wait(&p->idle, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Function to stop the workers and release the pool
+void pool_stop(WorkerPool *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->stopping = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int w = 0; w < p->num_workers; w++)
+    {
+        pthread_join(p->threads[w], NULL);
+    }
+    free(p->threads);
+    free(p->queue);
+    p->threads = NULL;
+    p->queue = NULL;
+    p->num_workers = 0;
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->idle);
+}
@@ -0,0 +1,53 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+// Pool of worker threads for data-parallel loops
+//
+// Work is submitted as a range of items cut into grains; idle workers take
+// the next grain from a shared queue, so uneven grains balance out
+// pool_submit returns at once, so the caller can keep receiving data
+// while the workers compute; pool_wait blocks until everything submitted is done
+
+// Runs items [first, first + count) of a submitted range on the worker numbered worker
+typedef void (*PoolTask)(void *ctx, int worker, int first, int count);
+
+// One grain waiting in the queue
+typedef struct
+{
+    PoolTask fn;
+    void *ctx;
+    int first;
+    int count;
+} PoolItem;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;   // signalled when grains are queued or the pool stops
+    pthread_cond_t idle;   // signalled when the last pending grain finishes
+    pthread_t *threads;
+    int num_workers;
+    PoolItem *queue;       // circular queue of grains
+    int capacity;
+    int head;
+    int size;
+    int pending;           // grains queued or running
+    int stopping;
+} WorkerPool;
+
+// Starts num_workers threads; worker w is pinned to cpus[w] when cpus is not NULL
+// Returns 0 on success, -1 on error
+int pool_start(WorkerPool *p, int num_workers, const int *cpus);
+
+// Queues items [first, first + count) in grains of up to grain items
+void pool_submit(WorkerPool *p, PoolTask fn, void *ctx, int first, int count, int grain);
+
+// Blocks until every submitted grain has run
+void pool_wait(WorkerPool *p);
+
+// Stops the workers and releases the pool
+void pool_stop(WorkerPool *p);
+
+#endif
@@ -0,0 +1,1021 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "protocol.h"
+
+// Reflected CRC32C (Castagnoli) polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[256];
+static int crc32c_table_ready = 0;
+
+// Function to build the lookup table for the software CRC32C
+static void crc32c_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32c_table[i] = c;
+    }
+    crc32c_table_ready = 1;
+}
+
+// Software CRC32C, one byte per table lookup
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    if (!crc32c_table_ready)
+        crc32c_init_table();
+
+    while (len--)
+    {
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Hardware CRC32C using the SSE4.2 crc32 instruction, 8 bytes at a time
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+
+    uint32_t c32 = (uint32_t)c;
+    while (len--)
+    {
+        c32 = __builtin_ia32_crc32qi(c32, *p++);
+    }
+    return c32;
+}
+#endif
+
+// Function to update a CRC32C, picking the hardware path when available
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len)
+{
+    static int use_hw = -1; // -1 until the CPU has been checked
+
+    if (use_hw < 0)
+    {
+#if defined(__x86_64__)
+        use_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+        use_hw = 0;
+#endif
+    }
+
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (use_hw)
+        return ~crc32c_hw(crc, (const unsigned char *)buf, len);
+#endif
+    return ~crc32c_sw(crc, (const unsigned char *)buf, len);
+}
+
+// Function to get the byte order of this machine
+uint8_t proto_native_order(void)
+{
+    const uint16_t probe = 1;
+    return (*(const uint8_t *)&probe == 1) ? PROTO_ORDER_LITTLE : PROTO_ORDER_BIG;
+}
+
+// Helpers to write / read big-endian fields
+static void put_u16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)(v >> 32));
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get_u16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+// Function to reverse the bytes of every size-byte element in a buffer
+static void swap_elems(void *buf, size_t bytes, size_t size)
+{
+    if (size == 2)
+    {
+        uint16_t *v = (uint16_t *)buf;
+        for (size_t k = 0; k < bytes / 2; k++)
+            v[k] = __builtin_bswap16(v[k]);
+    }
+    else if (size == 4)
+    {
+        uint32_t *v = (uint32_t *)buf;
+        for (size_t k = 0; k < bytes / 4; k++)
+            v[k] = __builtin_bswap32(v[k]);
+    }
+    else if (size == 8)
+    {
+        uint64_t *v = (uint64_t *)buf;
+        for (size_t k = 0; k < bytes / 8; k++)
+            v[k] = __builtin_bswap64(v[k]);
+    }
+}
+
+// Function to send a span in slices, checksumming each slice just before it is sent
+// A stable span (matrix data, unchanged until the run ends) may be sent zero-copy
+static int send_span(int fd, const unsigned char *p, size_t left, int stable, uint32_t *crc, TransferStats *stats)
+{
+    while (left > 0)
+    {
+        size_t len = left < PROTO_SLICE_BYTES ? left : PROTO_SLICE_BYTES;
+        *crc = crc32c_update(*crc, p, len);
+        if ((stable ? send_all_stable(fd, p, len, stats) : send_all(fd, p, len, stats)) != 0)
+            return -1;
+        p += len;
+        left -= len;
+    }
+    return 0;
+}
+
+// Function to get the file offset of a byte of a file-backed matrix
+static off_t file_offset_of(const Matrix *M, const unsigned char *p)
+{
+    return (off_t)(M->file_offset + (size_t)(p - (const unsigned char *)M->data));
+}
+
+// Function to send a span of a file-backed matrix in slices with sendfile
+// Each slice is checksummed through the mapping, but its bytes go from the
+// page cache to the socket without being copied through user space
+static int send_span_file(int fd, const Matrix *M, const unsigned char *p, size_t left, uint32_t *crc,
+                          TransferStats *stats)
+{
+    while (left > 0)
+    {
+        size_t len = left < PROTO_SLICE_BYTES ? left : PROTO_SLICE_BYTES;
+        *crc = crc32c_update(*crc, p, len);
+        if (sendfile_all(fd, M->fd, file_offset_of(M, p), len, stats) != 0)
+            return -1;
+        p += len;
+        left -= len;
+    }
+    return 0;
+}
+
+// Function to receive a span of a file-backed matrix in slices with splice,
+// then checksum (and byte-swap) each slice through the mapping
+static int recv_span_file(int fd, const int pipe_fds[2], const Matrix *M, unsigned char *p, size_t left, size_t swap,
+                          uint32_t *crc, TransferStats *stats)
+{
+    while (left > 0)
+    {
+        size_t len = left < PROTO_SLICE_BYTES ? left : PROTO_SLICE_BYTES;
+        if (splice_all(fd, pipe_fds, M->fd, file_offset_of(M, p), len, stats) != 0)
+            return -1;
+        *crc = crc32c_update(*crc, p, len);
+        if (swap)
+            swap_elems(p, len, swap);
+        p += len;
+        left -= len;
+    }
+    return 0;
+}
+
+// Function to receive a span in slices, checksumming (and byte-swapping elements
+// of swap bytes, 0 for none) each slice while it is still in cache
+static int recv_span(int fd, unsigned char *p, size_t left, size_t swap, uint32_t *crc, TransferStats *stats)
+{
+    while (left > 0)
+    {
+        size_t len = left < PROTO_SLICE_BYTES ? left : PROTO_SLICE_BYTES;
+        if (recv_all(fd, p, len, stats) != 0)
+            return -1;
+        *crc = crc32c_update(*crc, p, len);
+        if (swap)
+            swap_elems(p, len, swap);
+        p += len;
+        left -= len;
+    }
+    return 0;
+}
+
+// Function to locate byte off of the tile starting at block row `row`
+// Returns a pointer into M and, in *avail, how many bytes from there are contiguous in memory
+// Full-width blocks are one contiguous run, narrower ones are a run per row
+static const unsigned char *tile_at(const Matrix *M, const MatrixBlock *blk, int row, size_t tile_bytes,
+                                    size_t off, size_t *avail)
+{
+    if (blk->num_cols == M->cols)
+    {
+        *avail = tile_bytes - off;
+        return (const unsigned char *)matrix_row(M, blk->row_start + row) + off;
+    }
+
+    size_t esize = dtype_size(M->dtype);
+    size_t row_bytes = (size_t)blk->num_cols * esize;
+    size_t r = off / row_bytes;
+    size_t c = off % row_bytes;
+    *avail = row_bytes - c;
+    return (const unsigned char *)matrix_row(M, blk->row_start + row + (int)r) + blk->col_start * esize + c;
+}
+
+// Function to get the size on the wire of a tile of elems elements of esize bytes
+static size_t tile_wire_bytes(uint32_t encoding, size_t elems, size_t esize)
+{
+    return (encoding == PROTO_ENC_PACK4) ? (elems + 1) / 2 : elems * esize;
+}
+
+// Function to read element j of an integer row as an int
+static int int_at(ElemType t, const void *row, size_t j)
+{
+    if (t == DTYPE_INT8)
+        return ((const int8_t *)row)[j];
+    if (t == DTYPE_INT16)
+        return ((const int16_t *)row)[j];
+    return ((const int32_t *)row)[j];
+}
+
+// Function to pack elements [first, first + count) of the tile starting at block row `row`, two per byte
+// first is even, so every byte holds two elements of the tile; *len gets the bytes written to out
+// Returns 0 on success, -1 with errno ERANGE when an element lies outside 0-15
+static int pack_tile(const Matrix *M, const MatrixBlock *blk, int row, size_t first, size_t count,
+                     unsigned char *out, size_t *len)
+{
+    size_t cols = (size_t)blk->num_cols;
+    size_t r = first / cols;
+    size_t c = first % cols;
+    const void *src = matrix_row(M, blk->row_start + row + (int)r);
+    size_t k = 0;
+
+    for (size_t e = 0; e < count; e += 2)
+    {
+        unsigned char pair = 0;
+        for (int half = 0; half < 2 && e + half < count; half++)
+        {
+            if (c == cols) // next row of the block
+            {
+                r++;
+                c = 0;
+                src = matrix_row(M, blk->row_start + row + (int)r);
+            }
+            int v = int_at(M->dtype, src, blk->col_start + c);
+            if (v & ~0xF)
+            {
+                fprintf(stderr, "Row %d holds %d, which pack4 cannot carry\n", blk->row_start + row + (int)r, v);
+                errno = ERANGE;
+                return -1;
+            }
+            pair |= (unsigned char)(v << (4 * half));
+            c++;
+        }
+        out[k++] = pair;
+    }
+    *len = k;
+    return 0;
+}
+
+// Function to unpack count elements stored two per byte into integers of type t
+static void unpack_tile(const unsigned char *in, size_t count, ElemType t, void *out)
+{
+    for (size_t e = 0; e < count; e++)
+    {
+        int v = (e & 1) ? in[e / 2] >> 4 : in[e / 2] & 0xF;
+        if (t == DTYPE_INT8)
+            ((int8_t *)out)[e] = (int8_t)v;
+        else if (t == DTYPE_INT16)
+            ((int16_t *)out)[e] = (int16_t)v;
+        else
+            ((int32_t *)out)[e] = v;
+    }
+}
+
+// Function to get the tile height used for a block
+static int tile_rows(int chunk_rows, int num_rows)
+{
+    return (chunk_rows <= 0 || chunk_rows > num_rows) ? num_rows : chunk_rows;
+}
+
+// Function to build the header of a block
+static void build_header(unsigned char hdr[PROTO_HEADER_SIZE], const Matrix *M, const MatrixBlock *blk,
+                         const BlockTask *task, int tile, uint32_t flags)
+{
+    put_u32(hdr, PROTO_MAGIC);
+    put_u16(hdr + 4, PROTO_VERSION);
+    hdr[6] = (unsigned char)(M->dtype + 1);
+    hdr[7] = proto_native_order();
+    put_u32(hdr + 8, (uint32_t)M->cols);
+    put_u32(hdr + 12, (uint32_t)blk->row_start);
+    put_u32(hdr + 16, (uint32_t)blk->num_rows);
+    put_u32(hdr + 20, (uint32_t)blk->col_start);
+    put_u32(hdr + 24, (uint32_t)blk->num_cols);
+    put_u32(hdr + 28, (uint32_t)tile);
+    put_u32(hdr + 32, flags);
+    put_u32(hdr + 36, task ? task->kernel : 0);
+    put_u32(hdr + 40, task ? (uint32_t)task->vec_len : 0);
+    put_u64(hdr + 44, (uint64_t)blk->num_rows * blk->num_cols);
+    put_u64(hdr + 52, task ? task->seed : 0);
+    put_u32(hdr + 60, task ? task->encoding : PROTO_ENC_RAW);
+    put_u32(hdr + 64, task ? task->rank : 0);
+    put_u32(hdr + 68, task ? task->ranks : 0);
+    put_u32(hdr + 72, task ? task->stripes : 0);
+    put_u32(hdr + 76, crc32c_update(0, hdr, 76));
+}
+
+// Function to get the vector sent in the stream of a block
+// Under a broadcast only rank 0 gets it from the master, whole
+static const int *stream_vector(const BlockTask *task, uint32_t flags, size_t *len)
+{
+    *len = 0;
+    if (task == NULL)
+        return NULL;
+    if (flags & PROTO_FLAG_BCAST)
+    {
+        if (task->rank == 0 && task->bcast != NULL)
+            *len = (size_t)task->bcast_len;
+        return task->bcast;
+    }
+    *len = (size_t)task->vec_len;
+    return task->vec;
+}
+
+// Function to stream the region blk of M tile by tile, each tile followed by its checksum
+// Returns 0 on success, -1 on error
+static int send_tiles(int fd, const Matrix *M, const MatrixBlock *blk, int tile, uint32_t encoding,
+                      TransferStats *stats)
+{
+    // Packed tiles go through a buffer of one slice
+    unsigned char *pack = NULL;
+    if (encoding == PROTO_ENC_PACK4 && (pack = (unsigned char *)malloc(PROTO_SLICE_BYTES)) == NULL)
+        return -1;
+
+    int rc = 0;
+    int num_rows = blk->num_rows;
+    for (int r = 0; r < num_rows && rc == 0; r += tile)
+    {
+        int rows = (num_rows - r < tile) ? num_rows - r : tile;
+        size_t elems = (size_t)rows * blk->num_cols;
+        uint32_t crc = 0;
+        if (pack)
+        {
+            for (size_t e = 0; e < elems && rc == 0; e += 2 * (size_t)PROTO_SLICE_BYTES)
+            {
+                size_t count = (elems - e < 2 * (size_t)PROTO_SLICE_BYTES) ? elems - e : 2 * (size_t)PROTO_SLICE_BYTES;
+                size_t len;
+                rc = pack_tile(M, blk, r, e, count, pack, &len);
+                if (rc == 0)
+                    rc = send_span(fd, pack, len, 0, &crc, stats);
+            }
+        }
+        else
+        {
+            size_t tile_bytes = elems * dtype_size(M->dtype);
+            for (size_t off = 0; off < tile_bytes && rc == 0;)
+            {
+                size_t avail;
+                const unsigned char *p = tile_at(M, blk, r, tile_bytes, off, &avail);
+                rc = (M->fd >= 0) ? send_span_file(fd, M, p, avail, &crc, stats) : send_span(fd, p, avail, 1, &crc, stats);
+                off += avail;
+            }
+        }
+
+        unsigned char trailer[4];
+        put_u32(trailer, crc);
+        if (rc == 0)
+            rc = send_all(fd, trailer, sizeof(trailer), stats);
+    }
+
+    free(pack);
+    return rc == 0 ? 0 : -1;
+}
+
+// Function to get the rows of stripe k of a block
+int proto_stripe_rows(int num_rows, int stripes, int k, int *first)
+{
+    *first = (int)((long long)num_rows * k / stripes);
+    return (int)((long long)num_rows * (k + 1) / stripes) - *first;
+}
+
+// Function to get the region of stripe k of blk, the whole block when it is not striped
+static MatrixBlock stripe_block(const MatrixBlock *blk, int stripes, int k)
+{
+    MatrixBlock part = *blk;
+    if (stripes > 1)
+    {
+        int first;
+        part.num_rows = proto_stripe_rows(blk->num_rows, stripes, k, &first);
+        part.row_start += first;
+    }
+    return part;
+}
+
+// Function to send one block
+int proto_send_block(int fd, const Matrix *M, const MatrixBlock *blk, const BlockTask *task, int chunk_rows,
+                     uint32_t flags, TransferStats *stats)
+{
+    int tile = tile_rows(chunk_rows, blk->num_rows);
+
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    build_header(hdr, M, blk, task, tile, flags);
+
+    // With a corked socket the header, vector and tiles leave in full segments,
+    // and the last partial one when the block is uncorked; every path, failed
+    // or not, leaves through the uncork below
+    transfer_cork(fd, 1);
+    int rc = send_all(fd, hdr, sizeof(hdr), stats);
+
+    // The vector goes first, so the slave can compute on every tile as it arrives
+    size_t vec_len;
+    const int *vec = stream_vector(task, flags, &vec_len);
+    if (rc == 0 && vec_len > 0)
+    {
+        uint32_t crc = 0;
+        unsigned char trailer[4];
+        rc = send_span(fd, (const unsigned char *)vec, vec_len * sizeof(int), 0, &crc, stats);
+        put_u32(trailer, crc);
+        if (rc == 0)
+            rc = send_all(fd, trailer, sizeof(trailer), stats);
+    }
+
+    // Stream the block tile by tile (a seeded block is regenerated by the slave
+    // instead); a striped block only carries its first stripe here
+    if (rc == 0 && !(flags & PROTO_FLAG_SEEDED))
+    {
+        MatrixBlock part = stripe_block(blk, task ? (int)task->stripes : 1, 0);
+        rc = send_tiles(fd, M, &part, tile_rows(chunk_rows, part.num_rows), task ? task->encoding : PROTO_ENC_RAW,
+                        stats);
+    }
+    int err = errno; // of a failed send, for the caller
+    transfer_cork(fd, 0);
+    errno = err;
+    return rc;
+}
+
+// Structure for a thread sending one stripe of a block over an extra stream
+typedef struct
+{
+    int fd;
+    const Matrix *M;
+    MatrixBlock part; // rows of the stripe
+    BlockTask task;   // position of the stripe, no vector
+    int tile;
+    int rc;
+    int err; // errno of a failed send
+    TransferStats stats;
+} StripeSender;
+
+// Thread function sending the header and the tiles of one stripe
+static void *stripe_thread(void *arg)
+{
+    StripeSender *s = (StripeSender *)arg;
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    build_header(hdr, s->M, &s->part, &s->task, s->tile, PROTO_FLAG_STRIPE);
+
+    transfer_cork(s->fd, 1);
+    s->rc = send_all(s->fd, hdr, sizeof(hdr), &s->stats);
+    if (s->rc == 0)
+        s->rc = send_tiles(s->fd, s->M, &s->part, s->tile, s->task.encoding, &s->stats);
+    s->err = errno;
+    transfer_cork(s->fd, 0);
+    return NULL;
+}
+
+// Function to send a block striped over several streams
+int proto_send_striped(const int *fds, int streams, const Matrix *M, const MatrixBlock *blk, const BlockTask *task,
+                       int chunk_rows, uint32_t flags, TransferStats *stats)
+{
+    if (streams > PROTO_MAX_STREAMS)
+        streams = PROTO_MAX_STREAMS;
+    if (streams <= 1 || task == NULL || (flags & (PROTO_FLAG_SEEDED | PROTO_FLAG_PROBE)))
+        return proto_send_block(fds[0], M, blk, task, chunk_rows, flags, stats);
+
+    BlockTask striped = *task;
+    striped.stripes = (uint32_t)streams;
+
+    // Every extra stream gets its stripe from a thread of its own, while this
+    // thread sends the header, the vector and the first stripe
+    StripeSender senders[PROTO_MAX_STREAMS];
+    pthread_t tids[PROTO_MAX_STREAMS];
+    int started[PROTO_MAX_STREAMS] = {0};
+    for (int k = 1; k < streams; k++)
+    {
+        StripeSender *s = &senders[k];
+        memset(s, 0, sizeof(*s));
+        s->fd = fds[k];
+        s->M = M;
+        s->part = stripe_block(blk, streams, k);
+        s->task.seed = task->seed;
+        s->task.encoding = task->encoding;
+        s->task.rank = (uint32_t)k;
+        s->task.ranks = (uint32_t)streams;
+        s->tile = tile_rows(chunk_rows, s->part.num_rows);
+        s->rc = -1;
+        s->err = EAGAIN;
+        started[k] = (pthread_create(&tids[k], NULL, stripe_thread, s) == 0);
+    }
+
+    int rc = proto_send_block(fds[0], M, blk, &striped, chunk_rows, flags, stats);
+    int err = errno;
+
+    // A slave that gave up on the block stops reading its stripes too
+    // The header announced every stripe, so one whose thread could not be
+    // started is sent from here: the slave reads its streams in parallel
+    for (int k = 1; k < streams; k++)
+    {
+        if (rc != 0 && started[k])
+            shutdown(fds[k], SHUT_RDWR);
+        if (started[k])
+            pthread_join(tids[k], NULL);
+        else if (rc == 0)
+            stripe_thread(&senders[k]);
+        transfer_stats_add(stats, &senders[k].stats);
+        if (senders[k].rc != 0 && rc == 0)
+        {
+            rc = -1;
+            err = senders[k].err;
+        }
+    }
+    errno = err;
+    return rc;
+}
+
+// Function to build the header of a message between slaves: an empty block
+// of an n x n matrix of type dtype
+static void build_peer_header(unsigned char hdr[PROTO_HEADER_SIZE], int n, ElemType dtype, uint32_t kernel,
+                              int vec_len, uint32_t flags, uint32_t rank, uint32_t size)
+{
+    Matrix V;
+    V.rows = 1;
+    V.cols = n;
+    V.dtype = dtype;
+    MatrixBlock blk = {0, 0, 0, 0};
+    BlockTask task;
+    memset(&task, 0, sizeof(task));
+    task.kernel = kernel;
+    task.vec_len = vec_len;
+    task.rank = rank;
+    task.ranks = size;
+    build_header(hdr, &V, &blk, &task, 0, flags);
+}
+
+// Function to announce an extra stream to a slave
+int proto_send_stream(int fd, uint32_t index, uint32_t streams, TransferStats *stats)
+{
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    build_peer_header(hdr, 0, DTYPE_INT32, 0, 0, PROTO_FLAG_STREAM, index, streams);
+    return send_all(fd, hdr, sizeof(hdr), stats);
+}
+
+// Function to send a broadcast vector to a peer slave
+int proto_send_relay(int fd, const int *vec, int len, uint32_t kind, uint32_t rank, uint32_t size,
+                     TransferStats *stats)
+{
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    build_peer_header(hdr, len, DTYPE_INT32, 0, len, PROTO_FLAG_RELAY | kind, rank, size);
+    uint32_t crc = 0;
+    unsigned char trailer[4];
+    if (send_all(fd, hdr, sizeof(hdr), stats) != 0 ||
+        send_span(fd, (const unsigned char *)vec, (size_t)len * sizeof(int), 0, &crc, stats) != 0)
+        return -1;
+    put_u32(trailer, crc);
+    return send_all(fd, trailer, sizeof(trailer), stats);
+}
+
+// Function to send a partial sum of results to the parent slave
+int proto_send_partial(int fd, uint32_t kernel, ElemType dtype, int n, uint32_t kind, uint32_t rank, uint32_t size,
+                       const BlockReply *r, const int64_t *result, TransferStats *stats)
+{
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    build_peer_header(hdr, n, dtype, kernel, 0, PROTO_FLAG_PARTIAL | kind, rank, size);
+    if (send_all(fd, hdr, sizeof(hdr), stats) != 0)
+        return -1;
+    return proto_send_reply(fd, r, result, stats);
+}
+
+// Function to receive and validate a block header
+int proto_recv_header(int fd, BlockHeader *h, TransferStats *stats)
+{
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    int rc = recv_all(fd, hdr, sizeof(hdr), stats);
+    if (rc != 0)
+        return (rc == 1) ? PROTO_CLOSED : -1;
+
+    h->magic = get_u32(hdr);
+    h->version = get_u16(hdr + 4);
+    h->dtype = hdr[6];
+    h->byte_order = hdr[7];
+    h->n = get_u32(hdr + 8);
+    h->start_row = get_u32(hdr + 12);
+    h->num_rows = get_u32(hdr + 16);
+    h->col_start = get_u32(hdr + 20);
+    h->num_cols = get_u32(hdr + 24);
+    h->chunk_rows = get_u32(hdr + 28);
+    h->flags = get_u32(hdr + 32);
+    h->kernel = get_u32(hdr + 36);
+    h->vec_len = get_u32(hdr + 40);
+    h->count = get_u64(hdr + 44);
+    h->seed = get_u64(hdr + 52);
+    h->encoding = get_u32(hdr + 60);
+    h->rank = get_u32(hdr + 64);
+    h->ranks = get_u32(hdr + 68);
+    h->stripes = get_u32(hdr + 72);
+
+    if (h->magic != PROTO_MAGIC)
+    {
+        fprintf(stderr, "Bad header: wrong magic 0x%08x\n", h->magic);
+        return PROTO_STATUS_BAD_HEADER;
+    }
+    if (get_u32(hdr + 76) != crc32c_update(0, hdr, 76))
+    {
+        fprintf(stderr, "Bad header: checksum mismatch\n");
+        return PROTO_STATUS_BAD_HEADER;
+    }
+    if (h->version != PROTO_VERSION)
+    {
+        fprintf(stderr, "Bad header: unsupported version %u\n", h->version);
+        return PROTO_STATUS_BAD_HEADER;
+    }
+    if (h->dtype < PROTO_DTYPE_INT8 || h->dtype > PROTO_DTYPE_DOUBLE ||
+        (h->byte_order != PROTO_ORDER_LITTLE && h->byte_order != PROTO_ORDER_BIG) ||
+        h->count != (uint64_t)h->num_rows * h->num_cols ||
+        (uint64_t)h->start_row + h->num_rows > h->n ||
+        (uint64_t)h->col_start + h->num_cols > h->n ||
+        h->vec_len > h->n ||
+        (h->encoding != PROTO_ENC_RAW && h->encoding != PROTO_ENC_PACK4) ||
+        (h->encoding == PROTO_ENC_PACK4 && h->dtype > PROTO_DTYPE_INT32) ||
+        (h->num_rows > 0 && (h->chunk_rows == 0 || h->chunk_rows > h->num_rows)) ||
+        ((h->flags & (PROTO_FLAG_BCAST | PROTO_FLAG_REDUCE)) && h->rank >= h->ranks) ||
+        h->stripes > PROTO_MAX_STREAMS ||
+        ((h->flags & (PROTO_FLAG_STREAM | PROTO_FLAG_STRIPE)) && (h->rank == 0 || h->rank >= h->ranks || h->ranks > PROTO_MAX_STREAMS)))
+    {
+        fprintf(stderr, "Bad header: inconsistent block description\n");
+        return PROTO_STATUS_BAD_HEADER;
+    }
+
+    return 0;
+}
+
+// Function to receive the vector sent ahead of the tiles
+int proto_recv_vector(int fd, const BlockHeader *h, int *vec, TransferStats *stats)
+{
+    if (h->vec_len == 0)
+        return 0;
+
+    uint32_t crc = 0;
+    unsigned char trailer[4];
+    size_t swap = (h->byte_order != proto_native_order()) ? sizeof(int32_t) : 0;
+    if (recv_span(fd, (unsigned char *)vec, (size_t)h->vec_len * sizeof(int32_t), swap, &crc, stats) != 0 ||
+        recv_all(fd, trailer, sizeof(trailer), stats) != 0)
+        return -1;
+
+    return (get_u32(trailer) == crc) ? 0 : PROTO_ERR_CHECKSUM;
+}
+
+// Function to receive a block payload
+int proto_recv_payload(int fd, const BlockHeader *h, Matrix *dst, TileHandler on_tile, void *ctx,
+                       uint32_t *bad_tiles, TransferStats *stats)
+{
+    void *buf = dst->data;
+    int num_rows = (int)h->num_rows;
+    int tile = (int)h->chunk_rows;
+    ElemType dtype = (ElemType)(h->dtype - 1);
+    size_t esize = dtype_size(dtype);
+    size_t row_bytes = (size_t)h->num_cols * esize;
+    size_t swap = (esize > 1 && h->byte_order != proto_native_order()) ? esize : 0;
+    uint32_t bad = 0;
+
+    // Packed tiles arrive in a buffer of one slice and are unpacked from there
+    unsigned char *pack = NULL;
+    if (h->encoding == PROTO_ENC_PACK4 && (pack = (unsigned char *)malloc(PROTO_SLICE_BYTES)) == NULL)
+        return -1;
+
+    // Raw tiles for a file-backed block are spliced from the socket into the file,
+    // through a pipe that holds a whole slice; without a pipe they are received as usual
+    int pipe_fds[2] = {-1, -1};
+    if (dst->fd >= 0 && !pack && pipe2(pipe_fds, O_CLOEXEC) == 0)
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, PROTO_SLICE_BYTES);
+
+    // Receive, check and hand over one tile at a time; the kernel keeps
+    // buffering the next tile while the current one is being consumed
+    int failed = 0;
+    for (int r = 0; r < num_rows; r += tile)
+    {
+        int rows = (num_rows - r < tile) ? num_rows - r : tile;
+        unsigned char *p = (unsigned char *)buf + (size_t)r * row_bytes;
+        uint32_t crc = 0;
+        int rc = 0;
+        if (pack)
+        {
+            size_t elems = (size_t)rows * h->num_cols;
+            size_t wire = tile_wire_bytes(PROTO_ENC_PACK4, elems, esize);
+            for (size_t off = 0; off < wire && rc == 0; off += PROTO_SLICE_BYTES)
+            {
+                size_t len = (wire - off < PROTO_SLICE_BYTES) ? wire - off : PROTO_SLICE_BYTES;
+                if ((rc = recv_all(fd, pack, len, stats)) != 0)
+                    break;
+                crc = crc32c_update(crc, pack, len);
+                size_t count = (elems - 2 * off < 2 * len) ? elems - 2 * off : 2 * len;
+                unpack_tile(pack, count, dtype, p + 2 * off * esize);
+            }
+        }
+        else if (pipe_fds[0] >= 0)
+        {
+            rc = recv_span_file(fd, pipe_fds, dst, p, (size_t)rows * row_bytes, swap, &crc, stats);
+        }
+        else
+        {
+            rc = recv_span(fd, p, (size_t)rows * row_bytes, swap, &crc, stats);
+        }
+
+        unsigned char trailer[4];
+        if (rc != 0 || recv_all(fd, trailer, sizeof(trailer), stats) != 0)
+        {
+            failed = 1;
+            break;
+        }
+
+        int crc_ok = (get_u32(trailer) == crc);
+        if (!crc_ok)
+            bad++;
+        if (on_tile)
+            on_tile(ctx, r, rows, p, crc_ok);
+    }
+
+    free(pack);
+    if (pipe_fds[0] >= 0)
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+    if (failed)
+        return -1;
+    if (bad_tiles)
+        *bad_tiles = bad;
+    return bad == 0 ? 0 : PROTO_ERR_CHECKSUM;
+}
+
+// Function to send the reply and the results after it
+int proto_send_reply(int fd, const BlockReply *r, const int64_t *result, TransferStats *stats)
+{
+    unsigned char buf[PROTO_REPLY_SIZE];
+    put_u32(buf, PROTO_MAGIC);
+    put_u32(buf + 4, r->status);
+    put_u32(buf + 8, r->bad_tiles);
+    put_u32(buf + 12, r->result_count);
+    if (send_all(fd, buf, sizeof(buf), stats) != 0)
+        return -1;
+    if (r->result_count == 0)
+        return 0;
+
+    // Results are few (one per row or column), so they are encoded in one buffer
+    size_t bytes = proto_result_bytes(r->result_count);
+    unsigned char *out = (unsigned char *)malloc(bytes);
+    if (out == NULL)
+        return -1;
+    for (uint32_t k = 0; k < r->result_count; k++)
+    {
+        put_u64(out + (size_t)k * 8, (uint64_t)result[k]);
+    }
+    put_u32(out + bytes - 4, crc32c_update(0, out, bytes - 4));
+
+    int rc = send_all(fd, out, bytes, stats);
+    free(out);
+    return rc;
+}
+
+// Function to receive the reply
+int proto_recv_reply(int fd, BlockReply *r, TransferStats *stats)
+{
+    unsigned char buf[PROTO_REPLY_SIZE];
+    if (recv_all(fd, buf, sizeof(buf), stats) != 0)
+        return -1;
+
+    return proto_decode_reply(buf, r);
+}
+
+// Function to decode a reply
+int proto_decode_reply(const unsigned char buf[PROTO_REPLY_SIZE], BlockReply *r)
+{
+    if (get_u32(buf) != PROTO_MAGIC)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    r->status = get_u32(buf + 4);
+    r->bad_tiles = get_u32(buf + 8);
+    r->result_count = get_u32(buf + 12);
+    return 0;
+}
+
+// Function to receive the results following a reply
+// They land straight in out, checksummed as they arrive and turned from the
+// big-endian wire order in place, with their checksum received after them
+int proto_recv_result(int fd, const BlockReply *r, int64_t *out, TransferStats *stats)
+{
+    if (r->result_count == 0)
+        return 0;
+
+    size_t swap = (proto_native_order() == PROTO_ORDER_LITTLE) ? sizeof(int64_t) : 0;
+    uint32_t crc = 0;
+    unsigned char trailer[4];
+    if (recv_span(fd, (unsigned char *)out, (size_t)r->result_count * sizeof(int64_t), swap, &crc, stats) != 0 ||
+        recv_all(fd, trailer, sizeof(trailer), stats) != 0)
+        return -1;
+    return (get_u32(trailer) == crc) ? 0 : PROTO_ERR_CHECKSUM;
+}
+
+// Function to get the size of the results on the wire
+size_t proto_result_bytes(uint32_t count)
+{
+    return (size_t)count * 8 + 4;
+}
+
+// Function to decode results
+int proto_decode_result(const unsigned char *buf, uint32_t count, int64_t *out)
+{
+    size_t bytes = proto_result_bytes(count);
+    if (get_u32(buf + bytes - 4) != crc32c_update(0, buf, bytes - 4))
+        return PROTO_ERR_CHECKSUM;
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+        out[k] = (int64_t)get_u64(buf + (size_t)k * 8);
+    }
+    return 0;
+}
+
+// Function to set up the current tile of an incremental sender
+static void sender_start_tile(BlockSender *bs)
+{
+    int rows = (bs->blk.num_rows - bs->row < bs->tile) ? bs->blk.num_rows - bs->row : bs->tile;
+    bs->tile_bytes = tile_wire_bytes(bs->encoding, (size_t)rows * bs->blk.num_cols, dtype_size(bs->M->dtype));
+    bs->tile_off = 0;
+    bs->crc_off = 0;
+    bs->crc = 0;
+    bs->trailer_off = -1;
+}
+
+// Function to prepare an incremental sender
+void proto_sender_init(BlockSender *bs, const Matrix *M, const MatrixBlock *blk, const BlockTask *task,
+                       int chunk_rows, uint32_t flags)
+{
+    bs->M = M;
+    bs->blk = *blk;
+    bs->tile = tile_rows(chunk_rows, blk->num_rows);
+    build_header(bs->hdr, M, blk, task, bs->tile, flags);
+    bs->hdr_off = 0;
+
+    // The vector is small (one row or column), so its checksum is computed up front
+    size_t vec_len;
+    const int *vec = stream_vector(task, flags, &vec_len);
+    bs->vec = (vec_len > 0) ? (const unsigned char *)vec : NULL;
+    bs->vec_bytes = vec_len * sizeof(int);
+    bs->vec_off = 0;
+    bs->vec_trailer_off = bs->vec ? 0 : 4;
+    if (bs->vec)
+        put_u32(bs->vec_trailer, crc32c_update(0, bs->vec, bs->vec_bytes));
+    bs->row = (flags & PROTO_FLAG_SEEDED) ? blk->num_rows : 0; // seeded blocks have no tiles
+
+    // The pack buffer is kept from one block to the next
+    bs->encoding = task ? task->encoding : PROTO_ENC_RAW;
+    if (bs->encoding == PROTO_ENC_PACK4 && bs->pack == NULL)
+        bs->pack = (unsigned char *)malloc(PROTO_SLICE_BYTES);
+    bs->pack_len = 0;
+    sender_start_tile(bs);
+}
+
+// Function to release the buffers of a sender
+void proto_sender_free(BlockSender *bs)
+{
+    free(bs->pack);
+    bs->pack = NULL;
+}
+
+// Function to push the block out until the socket is full
+int proto_sender_step(BlockSender *bs, int fd, TransferStats *stats)
+{
+    // Header, corked with the rest of the block as in proto_send_block
+    if (bs->hdr_off == 0)
+        transfer_cork(fd, 1);
+    while (bs->hdr_off < PROTO_HEADER_SIZE)
+    {
+        long k = send_some(fd, bs->hdr + bs->hdr_off, PROTO_HEADER_SIZE - bs->hdr_off, stats);
+        if (k <= 0)
+            return (int)k;
+        bs->hdr_off += (size_t)k;
+    }
+
+    // Vector
+    while (bs->vec_off < bs->vec_bytes)
+    {
+        long k = send_some(fd, bs->vec + bs->vec_off, bs->vec_bytes - bs->vec_off, stats);
+        if (k <= 0)
+            return (int)k;
+        bs->vec_off += (size_t)k;
+    }
+    while (bs->vec_trailer_off < 4)
+    {
+        long k = send_some(fd, bs->vec_trailer + bs->vec_trailer_off, 4 - (size_t)bs->vec_trailer_off, stats);
+        if (k <= 0)
+            return (int)k;
+        bs->vec_trailer_off += (int)k;
+    }
+
+    // Tiles
+    while (bs->row < bs->blk.num_rows)
+    {
+        // Payload, checksummed one slice ahead of what has been sent
+        while (bs->tile_off < bs->tile_bytes)
+        {
+            const unsigned char *p;
+            if (bs->encoding == PROTO_ENC_PACK4)
+            {
+                // Pack the next slice once everything packed so far has been sent
+                if (bs->crc_off == bs->tile_off)
+                {
+                    int rows = (bs->blk.num_rows - bs->row < bs->tile) ? bs->blk.num_rows - bs->row : bs->tile;
+                    size_t elems = (size_t)rows * bs->blk.num_cols;
+                    size_t first = 2 * bs->tile_off;
+                    size_t count = (elems - first < 2 * (size_t)PROTO_SLICE_BYTES) ? elems - first : 2 * (size_t)PROTO_SLICE_BYTES;
+                    if (bs->pack == NULL)
+                        return -1;
+                    if (pack_tile(bs->M, &bs->blk, bs->row, first, count, bs->pack, &bs->pack_len) != 0)
+                        return -1;
+                    bs->crc = crc32c_update(bs->crc, bs->pack, bs->pack_len);
+                    bs->crc_off += bs->pack_len;
+                }
+                p = bs->pack + bs->pack_len - (bs->crc_off - bs->tile_off);
+            }
+            else
+            {
+                size_t avail;
+                p = tile_at(bs->M, &bs->blk, bs->row, bs->tile_bytes, bs->tile_off, &avail);
+                if (bs->crc_off == bs->tile_off)
+                {
+                    size_t len = avail < PROTO_SLICE_BYTES ? avail : PROTO_SLICE_BYTES;
+                    bs->crc = crc32c_update(bs->crc, p, len);
+                    bs->crc_off += len;
+                }
+            }
+
+            long k = (bs->M->fd >= 0 && bs->encoding != PROTO_ENC_PACK4)
+                         ? sendfile_some(fd, bs->M->fd, file_offset_of(bs->M, p), bs->crc_off - bs->tile_off, stats)
+                         : send_some(fd, p, bs->crc_off - bs->tile_off, stats);
+            if (k <= 0)
+                return (int)k;
+            bs->tile_off += (size_t)k;
+        }
+
+        // Trailer
+        if (bs->trailer_off < 0)
+        {
+            put_u32(bs->trailer, bs->crc);
+            bs->trailer_off = 0;
+        }
+        while (bs->trailer_off < 4)
+        {
+            long k = send_some(fd, bs->trailer + bs->trailer_off, 4 - (size_t)bs->trailer_off, stats);
+            if (k <= 0)
+                return (int)k;
+            bs->trailer_off += (int)k;
+        }
+
+        bs->row += bs->tile;
+        if (bs->row < bs->blk.num_rows)
+            sender_start_tile(bs);
+    }
+
+    transfer_cork(fd, 0);
+    return 1;
+}
@@ -0,0 +1,278 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "matrix.h"
+#include "transfer.h"
+
+// Wire protocol between master and slave
+//
+// master -> slave : block header (PROTO_HEADER_SIZE bytes, big-endian fields)
+//                   if vec_len > 0: vector (32-bit integers in the byte order named by the header)
+//                                   vector CRC32C (4 bytes, big-endian)
+//                   unless PROTO_FLAG_SEEDED, for each tile of chunk_rows rows (the last one may be shorter):
+//                       tile payload (elements of the type, encoding and byte order named by the header)
+//                       tile CRC32C (4 bytes, big-endian)
+// slave -> master : reply (PROTO_REPLY_SIZE bytes, big-endian fields)
+//                   if result_count > 0: result (64-bit big-endian integers)
+//                                        result CRC32C (4 bytes, big-endian)
+//
+// A block is a rectangle of the matrix (rows x columns); row blocks span
+// every column, column and 2D partitions send narrower rectangles
+// The header carries its own CRC32C, each tile CRC is computed slice by
+// slice while the data streams so no extra pass over the block is needed
+// The slave checks and consumes a tile as soon as it has arrived, while
+// the next tile is still in flight
+// The header names the compute kernel the slave runs over the tiles; the
+// vector it needs is sent first so every tile can be computed on arrival
+// With PROTO_FLAG_SEEDED no tiles follow: the matrix was generated from the
+// seed in the header and the slave regenerates its block locally, bit for bit
+// Tiles are raw elements in the block's dtype, or packed two values per byte
+// (low nibble first, the last byte of an odd tile padded with 0) when the
+// master asks for PROTO_ENC_PACK4, which only carries values 0-15 (a block
+// holding any other value fails to send); the checksum covers the bytes as
+// sent, and a slave that does not know the encoding refuses the block with
+// PROTO_STATUS_BAD_HEADER
+// With PROTO_FLAG_BCAST_TREE or _CHAIN the vector is broadcast instead: only
+// the block of rank 0 carries it, whole (n elements), and every slave that
+// has it forwards it to its children as a relay (a header with
+// PROTO_FLAG_RELAY and vec_len = n, then the vector and its CRC) on their
+// listening port; each slave then takes the part its block needs
+//   tree  : binomial tree, rank r forwards to r + 2^k for every 2^k > r
+//   chain : rank r forwards to r + 1
+// With PROTO_FLAG_REDUCE_TREE or _CHAIN the results are reduced the other way:
+// each slave adds those of its children (in the same tree or chain) to its own,
+// spread over the whole output, and sends the sum to its parent as a partial
+// (a header with PROTO_FLAG_PARTIAL, then a reply and its results); rank 0
+// replies to the master with the total, the others with no results
+// With stripes > 1 in the header the tiles are striped over several TCP streams
+// to the same slave: the rows are cut into that many stripes of about equal
+// height (proto_stripe_rows), the block's own connection carries the header,
+// the vector and the tiles of stripe 0, and every other stripe goes over an
+// extra stream as a header with PROTO_FLAG_STRIPE (rank = stripe, ranks =
+// stripes, the stripe's rows, no vector) followed by its tiles; the slave
+// receives the stripes side by side into one block and replies once, on the
+// block's connection. An extra stream announces itself when it is opened with
+// a header of PROTO_FLAG_STREAM, and stays open for the stripes of later blocks
+
+#define PROTO_MAGIC 0x4C423034u // "LB04"
+#define PROTO_VERSION 9
+#define PROTO_HEADER_SIZE 80
+#define PROTO_REPLY_SIZE 16
+#define PROTO_SLICE_BYTES (256 * 1024) // payload is checksummed and moved in slices of this size
+#define PROTO_MAX_STREAMS 16             // streams a block can be striped over
+
+// Element types (ElemType + 1)
+#define PROTO_DTYPE_INT8 1
+#define PROTO_DTYPE_INT16 2
+#define PROTO_DTYPE_INT32 3
+#define PROTO_DTYPE_FLOAT 4
+#define PROTO_DTYPE_DOUBLE 5
+
+// Tile encodings
+#define PROTO_ENC_RAW 0   // elements in the block's dtype
+#define PROTO_ENC_PACK4 1 // 4 bits per element, for integer values 0 to 15
+
+// Header flags
+#define PROTO_FLAG_PROBE 0x1u  // capacity probe, the slave only acknowledges it
+#define PROTO_FLAG_SEEDED 0x2u // no payload, the slave generates the block from the seed
+#define PROTO_FLAG_BCAST_TREE 0x4u  // the vector is broadcast along a binomial tree of the slaves
+#define PROTO_FLAG_BCAST_CHAIN 0x8u // the vector is broadcast along a chain of the slaves
+#define PROTO_FLAG_RELAY 0x10u      // slave to slave: a broadcast vector, no block
+#define PROTO_FLAG_REDUCE_TREE 0x20u  // the results are summed up a binomial tree of the slaves
+#define PROTO_FLAG_REDUCE_CHAIN 0x40u // the results are summed up a chain of the slaves
+#define PROTO_FLAG_PARTIAL 0x80u      // slave to slave: a partial sum of the results, no block
+#define PROTO_FLAG_STREAM 0x100u      // master to slave: opens an extra stream, no block
+#define PROTO_FLAG_STRIPE 0x200u      // master to slave on an extra stream: one stripe of a block, no vector
+#define PROTO_FLAG_BCAST (PROTO_FLAG_BCAST_TREE | PROTO_FLAG_BCAST_CHAIN)
+#define PROTO_FLAG_REDUCE (PROTO_FLAG_REDUCE_TREE | PROTO_FLAG_REDUCE_CHAIN)
+
+// Byte orders
+#define PROTO_ORDER_LITTLE 1
+#define PROTO_ORDER_BIG 2
+
+// Reply status codes
+#define PROTO_STATUS_OK 0
+#define PROTO_STATUS_BAD_HEADER 1
+#define PROTO_STATUS_CHECKSUM 2
+#define PROTO_STATUS_INCOMPLETE 3 // a reduce is missing the results of some slaves
+
+// Return value of proto_recv_header when the peer closed the connection instead of sending a block
+#define PROTO_CLOSED (-3)
+
+// Return value of proto_recv_payload when the data arrived but a tile checksum did not match
+#define PROTO_ERR_CHECKSUM (-2)
+
+// Header of one block
+typedef struct
+{
+    uint32_t magic;      // PROTO_MAGIC
+    uint16_t version;    // PROTO_VERSION
+    uint8_t dtype;       // element type of the payload
+    uint8_t byte_order;  // byte order of the payload elements
+    uint32_t n;          // matrix size (elements per row)
+    uint32_t start_row;  // first row of the block
+    uint32_t num_rows;   // rows in the block
+    uint32_t col_start;  // first column of the block
+    uint32_t num_cols;   // columns in the block
+    uint32_t chunk_rows; // rows per streamed tile
+    uint32_t flags;      // PROTO_FLAG_*
+    uint32_t kernel;     // compute kernel to run over the block, 0 for none
+    uint32_t vec_len;    // elements in the vector sent ahead of the tiles
+    uint64_t count;      // elements in the payload
+    uint64_t seed;       // seed of the matrix, used with PROTO_FLAG_SEEDED
+    uint32_t encoding;   // PROTO_ENC_* of the tiles
+    uint32_t rank;       // position of the receiver in a broadcast or reduce
+    uint32_t ranks;      // slaves in the broadcast or reduce
+    uint32_t stripes;    // streams the tiles are striped over, 0 or 1 = the block's connection only
+} BlockHeader;
+
+// Computation requested along with a block
+typedef struct
+{
+    uint32_t kernel; // compute kernel to run over the block, 0 for none
+    const int *vec;  // vector the kernel needs (may be NULL)
+    int vec_len;     // elements in vec
+    uint64_t seed;   // seed the matrix was generated from, sent with PROTO_FLAG_SEEDED
+    uint32_t encoding; // PROTO_ENC_* of the tiles
+    const int *bcast;    // whole vector when it is broadcast (PROTO_FLAG_BCAST_*), NULL otherwise
+    int bcast_len;       // elements in bcast
+    uint32_t rank;       // position of the slave in a broadcast or reduce, rank 0 talks to the master
+    uint32_t ranks;      // slaves in the broadcast or reduce
+    uint32_t stripes;    // streams the tiles are striped over (set by proto_send_striped)
+} BlockTask;
+
+// Reply sent back by the slave once the block was handled
+typedef struct
+{
+    uint32_t status;       // PROTO_STATUS_*
+    uint32_t bad_tiles;    // tiles whose checksum did not match
+    uint32_t result_count; // 64-bit results following the reply
+} BlockReply;
+
+// Updates a CRC32C with len more bytes (start with crc = 0)
+// Uses the SSE4.2 crc32 instruction when the CPU has it
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len);
+
+// Returns the byte order of this machine (PROTO_ORDER_*)
+uint8_t proto_native_order(void);
+
+// Called by proto_recv_payload for every tile once it has arrived and been checked
+// first_row is relative to the start of the block, crc_ok is 0 if the tile was corrupted
+typedef void (*TileHandler)(void *ctx, int first_row, int rows, void *data, int crc_ok);
+
+// Sends the header, the vector of task (task may be NULL) and the region blk of M as checksummed tiles
+// chunk_rows is the tile height, 0 sends the whole block as a single tile
+// Raw tiles of a file-backed M are sent with sendfile
+// Returns 0 on success, -1 on error (errno is set)
+int proto_send_block(int fd, const Matrix *M, const MatrixBlock *blk, const BlockTask *task, int chunk_rows,
+                     uint32_t flags, TransferStats *stats);
+
+// Sends a block striped over streams connections to the same slave
+// fds[0] is the block's own connection and gets the header and the vector;
+// stripe k goes over fds[k], sent by a thread of its own
+// With one stream, no task or no tiles (seeded or probe) this is proto_send_block on fds[0]
+// Returns 0 on success, -1 on error (errno is set)
+int proto_send_striped(const int *fds, int streams, const Matrix *M, const MatrixBlock *blk, const BlockTask *task,
+                       int chunk_rows, uint32_t flags, TransferStats *stats);
+
+// Gets the rows of stripe k of a block of num_rows rows striped over stripes streams
+// Returns the number of rows; *first receives the first of them, relative to the block
+int proto_stripe_rows(int num_rows, int stripes, int k, int *first);
+
+// Announces the extra stream index of streams to a slave, right after connecting (PROTO_FLAG_STREAM)
+// Returns 0 on success, -1 on error (errno is set)
+int proto_send_stream(int fd, uint32_t index, uint32_t streams, TransferStats *stats);
+
+// Sends a broadcast vector of len elements to a peer slave (PROTO_FLAG_RELAY)
+// kind is PROTO_FLAG_BCAST_TREE or _CHAIN, rank and size place the receiver in the broadcast
+// Returns 0 on success, -1 on error (errno is set)
+int proto_send_relay(int fd, const int *vec, int len, uint32_t kind, uint32_t rank, uint32_t size,
+                     TransferStats *stats);
+
+// Sends a partial sum of results (r->result_count of them, of element type dtype) to
+// the parent slave in a reduce (PROTO_FLAG_PARTIAL); the parent reads it with
+// proto_recv_reply and proto_recv_result after the header
+// kind is PROTO_FLAG_REDUCE_TREE or _CHAIN, rank places the sender in the reduce
+// Returns 0 on success, -1 on error (errno is set)
+int proto_send_partial(int fd, uint32_t kernel, ElemType dtype, int n, uint32_t kind, uint32_t rank, uint32_t size,
+                       const BlockReply *r, const int64_t *result, TransferStats *stats);
+
+// Receives and validates a block header
+// Returns 0 on success, -1 on transfer error, PROTO_CLOSED if the peer closed the connection,
+// PROTO_STATUS_BAD_HEADER if the header is invalid
+int proto_recv_header(int fd, BlockHeader *h, TransferStats *stats);
+
+// Receives the vector described by h into vec (h->vec_len elements), converting it to the native byte order
+// Returns 0 on success, -1 on transfer error, PROTO_ERR_CHECKSUM on mismatch
+int proto_recv_vector(int fd, const BlockHeader *h, int *vec, TransferStats *stats);
+
+// Receives the payload described by h into dst (num_rows x num_cols elements of type h->dtype),
+// converting it to the native byte order; raw tiles for a file-backed dst are spliced into its file
+// Each tile is checksummed while it arrives and then handed to on_tile (may be NULL)
+// The number of corrupted tiles is returned in *bad_tiles
+// Returns 0 on success, -1 on transfer error, PROTO_ERR_CHECKSUM on mismatch
+int proto_recv_payload(int fd, const BlockHeader *h, Matrix *dst, TileHandler on_tile, void *ctx,
+                       uint32_t *bad_tiles, TransferStats *stats);
+
+// Sends the reply that closes a block exchange, followed by r->result_count results
+int proto_send_reply(int fd, const BlockReply *r, const int64_t *result, TransferStats *stats);
+
+// Receives the reply that closes a block exchange (without its results)
+int proto_recv_reply(int fd, BlockReply *r, TransferStats *stats);
+
+// Receives the r->result_count results following a reply into out
+// Returns 0 on success, -1 on transfer error, PROTO_ERR_CHECKSUM on mismatch
+int proto_recv_result(int fd, const BlockReply *r, int64_t *out, TransferStats *stats);
+
+// Decodes a reply received by other means
+// Returns 0 on success, -1 if the reply is malformed
+int proto_decode_reply(const unsigned char buf[PROTO_REPLY_SIZE], BlockReply *r);
+
+// Size on the wire of count results, checksum included
+size_t proto_result_bytes(uint32_t count);
+
+// Decodes count results received by other means
+// Returns 0 on success, PROTO_ERR_CHECKSUM on mismatch
+int proto_decode_result(const unsigned char *buf, uint32_t count, int64_t *out);
+
+// Incremental sender for non-blocking sockets
+// Produces exactly the same bytes as proto_send_block, but stops whenever
+// the socket is full and resumes where it left off on the next call
+typedef struct
+{
+    const Matrix *M;
+    MatrixBlock blk;
+    int tile;                              // tile height
+    unsigned char hdr[PROTO_HEADER_SIZE];
+    size_t hdr_off;                        // header bytes already sent
+    const unsigned char *vec;              // vector sent ahead of the tiles
+    size_t vec_bytes;
+    size_t vec_off;                        // vector bytes already sent
+    unsigned char vec_trailer[4];          // checksum of the vector
+    int vec_trailer_off;                   // vector checksum bytes already sent
+    int row;                               // first row (within the block) of the current tile
+    size_t tile_bytes;                     // size of the current tile on the wire
+    size_t tile_off;                       // payload bytes of the current tile already sent
+    size_t crc_off;                        // payload bytes of the current tile already checksummed
+    uint32_t encoding;                     // PROTO_ENC_* of the tiles
+    unsigned char *pack;                   // packed slice of the current tile (PROTO_ENC_PACK4)
+    size_t pack_len;                       // bytes in pack
+    uint32_t crc;                          // checksum of the current tile so far
+    unsigned char trailer[4];
+    int trailer_off;                       // trailer bytes sent, -1 while the payload is in progress
+} BlockSender;
+
+// Prepares a sender for the region blk of M and the vector of task (task may be NULL)
+void proto_sender_init(BlockSender *bs, const Matrix *M, const MatrixBlock *blk, const BlockTask *task,
+                       int chunk_rows, uint32_t flags);
+
+// Sends as much of the block as the socket accepts
+// Returns 1 once the whole block has been sent, 0 if the socket is full, -1 on error
+int proto_sender_step(BlockSender *bs, int fd, TransferStats *stats);
+
+// Releases the buffers of a sender
+void proto_sender_free(BlockSender *bs);
+
+#endif
@@ -37,7 +37,8 @@ DRONES=(
 # Create config file for swarm deployment - DYNAMICALLY
 cat > config.txt << EOF
 # Configuration file for lab04 - ICS Compute Swarm
-# Format: IP_ADDRESS PORT_NUMBER ROLE
+# Format: HOST PORT_NUMBER ROLE [WEIGHT [STREAMS]]  (HOST may be a hostname, IPv4 or IPv6 address)
+# Lines with two fields are options, e.g. "chunk_rows 64"
 
 # Master (lab PC)
 ${LOCAL_IP} ${MASTER_PORT} master
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "partition.h"
+#include "scheduler.h"
+
+// Function to allocate the per-slave and per-tile arrays of a scheduler
+static int scheduler_alloc(TileScheduler *ts, int num_tiles, int num_slaves, int steal)
+{
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->cond, NULL);
+    ts->num_tiles = num_tiles;
+    ts->num_slaves = num_slaves;
+    ts->steal = steal;
+    ts->tiles = (MatrixBlock *)malloc((num_tiles + 1) * sizeof(MatrixBlock));
+    ts->home_first = (int *)malloc(num_slaves * sizeof(int));
+    ts->home_last = (int *)malloc(num_slaves * sizeof(int));
+    ts->own_first = (int *)malloc(num_slaves * sizeof(int));
+    ts->own_last = (int *)malloc(num_slaves * sizeof(int));
+    ts->orphans = (int *)malloc((num_tiles + 1) * sizeof(int));
+    ts->done_by = (int *)malloc((num_tiles + 1) * sizeof(int));
+    ts->tiles_done = (long *)calloc(num_slaves, sizeof(long));
+    ts->tiles_stolen = (long *)calloc(num_slaves, sizeof(long));
+
+    if (!ts->tiles || !ts->home_first || !ts->home_last || !ts->own_first || !ts->own_last ||
+        !ts->orphans || !ts->done_by || !ts->tiles_done || !ts->tiles_stolen)
+    {
+        perror("Scheduler allocation failed");
+        scheduler_free(ts);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to set up a static scheduler
+int scheduler_init_static(TileScheduler *ts, int num_slaves, const MatrixBlock blocks[])
+{
+    if (scheduler_alloc(ts, num_slaves, num_slaves, 0) != 0)
+        return -1;
+
+    for (int s = 0; s < num_slaves; s++)
+    {
+        ts->tiles[s] = blocks[s];
+        ts->home_first[s] = s;
+        ts->home_last[s] = s + 1;
+    }
+    scheduler_reset(ts);
+    return 0;
+}
+
+// Function to set up a dynamic scheduler
+int scheduler_init_dynamic(TileScheduler *ts, int n, int num_slaves, const double weights[], int tile_rows)
+{
+    if (tile_rows <= 0)
+        tile_rows = 1;
+    int num_tiles = (n + tile_rows - 1) / tile_rows;
+
+    if (scheduler_alloc(ts, num_tiles, num_slaves, 1) != 0)
+        return -1;
+
+    for (int t = 0; t < num_tiles; t++)
+    {
+        int first = t * tile_rows;
+        MatrixBlock tile = {first, (n - first < tile_rows) ? n - first : tile_rows, 0, n};
+        ts->tiles[t] = tile;
+    }
+
+    // Each slave starts on a contiguous share of the tiles, sized by its weight
+    int *len = (int *)malloc(num_slaves * sizeof(int));
+    partition_split(num_tiles, num_slaves, weights, ts->home_first, len);
+    for (int s = 0; s < num_slaves; s++)
+    {
+        ts->home_last[s] = ts->home_first[s] + len[s];
+    }
+    free(len);
+
+    scheduler_reset(ts);
+    return 0;
+}
+
+// Function to restore the initial ranges for the next job
+void scheduler_reset(TileScheduler *ts)
+{
+    pthread_mutex_lock(&ts->lock);
+    for (int s = 0; s < ts->num_slaves; s++)
+    {
+        ts->own_first[s] = ts->home_first[s];
+        ts->own_last[s] = ts->home_last[s];
+    }
+    for (int t = 0; t < ts->num_tiles; t++)
+    {
+        ts->done_by[t] = -1;
+    }
+    ts->num_orphans = 0;
+    ts->in_flight = 0;
+    pthread_mutex_unlock(&ts->lock);
+}
+
+// Function to hand the next tile to a slave
+// Own tiles first (in order, so consecutive blocks stay local), then tiles
+// given back by failed slaves, then the last tile of the largest range left
+int scheduler_next(TileScheduler *ts, int slave, MatrixBlock *blk, int wait)
+{
+    int t = -1;
+
+    pthread_mutex_lock(&ts->lock);
+    for (;;)
+    {
+        if (ts->own_first[slave] < ts->own_last[slave])
+        {
+            t = ts->own_first[slave]++;
+            break;
+        }
+        if (!ts->steal)
+            break;
+
+        if (ts->num_orphans > 0)
+        {
+            t = ts->orphans[--ts->num_orphans];
+            ts->tiles_stolen[slave]++;
+            break;
+        }
+
+        int victim = -1;
+        int most = 0;
+        for (int v = 0; v < ts->num_slaves; v++)
+        {
+            int left = ts->own_last[v] - ts->own_first[v];
+            if (left > most)
+            {
+                most = left;
+                victim = v;
+            }
+        }
+        if (victim >= 0)
+        {
+            t = --ts->own_last[victim];
+            ts->tiles_stolen[slave]++;
+            break;
+        }
+
+        // Nothing left to take; tiles still in flight may yet be given back
+        if (!wait || ts->in_flight == 0)
+            break;
+        pthread_cond_wait(&ts->cond, &ts->lock);
+    }
+
+    if (t >= 0)
+    {
+        ts->in_flight++;
+        *blk = ts->tiles[t];
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return t;
+}
+
+// Function to record a completed tile
+void scheduler_complete(TileScheduler *ts, int tile, int slave)
+{
+    pthread_mutex_lock(&ts->lock);
+    ts->done_by[tile] = slave;
+    ts->tiles_done[slave]++;
+    ts->in_flight--;
+    pthread_cond_broadcast(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+// Function to give a tile back after a failed transfer
+void scheduler_abandon(TileScheduler *ts, int tile, int slave)
+{
+    (void)slave;
+
+    pthread_mutex_lock(&ts->lock);
+    ts->orphans[ts->num_orphans++] = tile;
+    ts->in_flight--;
+    pthread_cond_broadcast(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+// Function to count the tiles nobody completed in the current job
+int scheduler_missing(TileScheduler *ts)
+{
+    int missing = 0;
+    pthread_mutex_lock(&ts->lock);
+    for (int t = 0; t < ts->num_tiles; t++)
+    {
+        if (ts->done_by[t] < 0)
+            missing++;
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return missing;
+}
+
+// Function to print the work done by every slave
+void scheduler_print(const TileScheduler *ts)
+{
+    for (int s = 0; s < ts->num_slaves; s++)
+    {
+        printf("Slave %d: %ld tiles completed, %ld stolen\n", s, ts->tiles_done[s], ts->tiles_stolen[s]);
+    }
+}
+
+// Function to release the scheduler
+void scheduler_free(TileScheduler *ts)
+{
+    free(ts->tiles);
+    free(ts->home_first);
+    free(ts->home_last);
+    free(ts->own_first);
+    free(ts->own_last);
+    free(ts->orphans);
+    free(ts->done_by);
+    free(ts->tiles_done);
+    free(ts->tiles_stolen);
+    ts->tiles = NULL;
+    ts->home_first = ts->home_last = ts->own_first = ts->own_last = NULL;
+    ts->orphans = ts->done_by = NULL;
+    ts->tiles_done = ts->tiles_stolen = NULL;
+    pthread_mutex_destroy(&ts->lock);
+    pthread_cond_destroy(&ts->cond);
+}
@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include "matrix.h"
+
+// Work scheduler shared by the master's sender threads / event loops
+//
+// The work of a job is a list of tiles (blocks of M). Every slave owns a
+// contiguous range of them, sized by its weight, and takes tiles from the
+// front of its range. In dynamic mode a slave that runs out steals tiles
+// from the back of the largest remaining range (or picks up tiles given
+// back by a failed slave), so fast slaves keep working until the whole
+// job is done instead of waiting for the stragglers
+// In static mode every slave owns exactly its partition block and nothing is stolen
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;   // signalled when a tile completes or is given back
+    MatrixBlock *tiles;    // work units of a job
+    int num_tiles;
+    int num_slaves;
+    int steal;             // 1 if idle slaves may take other slaves' tiles
+    int *home_first;       // per slave: initial range [home_first, home_last) of tiles
+    int *home_last;
+    int *own_first;        // per slave: tiles [own_first, own_last) not handed out yet
+    int *own_last;
+    int *orphans;          // tiles given back by slaves that failed
+    int num_orphans;
+    int in_flight;         // tiles handed out and not completed / given back yet
+    int *done_by;          // per tile: slave that completed it in this job, -1 if none
+    long *tiles_done;      // per slave: tiles completed over all jobs
+    long *tiles_stolen;    // per slave: tiles taken from other slaves over all jobs
+} TileScheduler;
+
+// Sets up a static scheduler, slave s getting blocks[s]
+// Returns 0 on success, -1 on error
+int scheduler_init_static(TileScheduler *ts, int num_slaves, const MatrixBlock blocks[]);
+
+// Sets up a dynamic scheduler over row tiles of tile_rows rows of an n x n matrix
+// Slave s initially owns a contiguous share of the tiles proportional to weights[s]
+// Returns 0 on success, -1 on error
+int scheduler_init_dynamic(TileScheduler *ts, int n, int num_slaves, const double weights[], int tile_rows);
+
+// Restores the initial ranges for the next job
+// Must not be called while tiles are in flight
+void scheduler_reset(TileScheduler *ts);
+
+// Hands the next tile to a slave and stores it in *blk
+// With wait, blocks while nothing is left to take but other slaves still have
+// tiles in flight (they may give them back); the caller must have none in flight
+// Returns the tile index, or -1 once there is no work left for this slave
+int scheduler_next(TileScheduler *ts, int slave, MatrixBlock *blk, int wait);
+
+// Records a tile as completed by a slave
+void scheduler_complete(TileScheduler *ts, int tile, int slave);
+
+// Gives a tile back after its transfer failed, so another slave can take it
+void scheduler_abandon(TileScheduler *ts, int tile, int slave);
+
+// Returns the number of tiles nobody completed in the current job
+int scheduler_missing(TileScheduler *ts);
+
+// Prints the tiles completed and stolen by every slave
+void scheduler_print(const TileScheduler *ts);
+
+// Releases the scheduler
+void scheduler_free(TileScheduler *ts);
+
+#endif
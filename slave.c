@@ -0,0 +1,1046 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "transfer.h"
+#include "protocol.h"
+#include "kernel.h"
+#include "pool.h"
+#include "topology.h"
+#include "slave.h"
+
+#define WORKER_TILE_BYTES (256 * 1024) // rows are handed to the workers in tiles of about this size (fits in L2)
+#define PEER_TIMEOUT_MS 30000          // how long a slave waits for a relay from its parent or a partial from a child
+#define SLAVE_PEER 1                   // slave_handle_block took a message from a peer slave instead of a block
+#define MAX_PEER_CHILDREN 32
+
+// Broadcast, reduce and extra stream state of the slave, kept across connections
+typedef struct
+{
+    int listen_fd;    // relays and partials from peer slaves arrive on the listening socket
+    Cluster *cluster; // rank r of a broadcast or reduce is slave r of the config
+    int *vec;         // broadcast vector that arrived ahead of its block, NULL if none
+    uint32_t len;     // elements in vec
+    int64_t *sum;     // sum of the partials received from the children, NULL if none yet
+    uint32_t sum_len; // results in sum
+    int partials;     // partials received from the children
+    int incomplete;   // 1 if a child reported missing results
+    pthread_mutex_t lock;
+    pthread_cond_t idle; // signalled when the last relay thread finishes
+    int relays;          // relay threads still sending
+    int streams[PROTO_MAX_STREAMS]; // extra streams of the master, kept for the stripes of later blocks
+    int num_streams;
+} Collective;
+
+// Structure for a thread forwarding the broadcast vector to one child
+typedef struct
+{
+    Collective *owner;
+    const SlaveInfo *peer;
+    int *vec; // own copy, released by the thread
+    uint32_t len;
+    uint32_t kind; // PROTO_FLAG_BCAST_TREE or _CHAIN
+    uint32_t rank; // rank of the child
+    uint32_t size;
+} RelayArgs;
+
+// State of the block being received, shared with the tile handler
+typedef struct
+{
+    Matrix *submatrix;   // destination of the block
+    int tiles;           // tiles consumed so far
+    int bad_tiles;       // tiles that failed their checksum
+    KernelKind kernel;   // computation to run over every tile
+    const int *vec;      // vector sent with the block
+    int64_t *result;     // partial results of the block
+    int result_len;
+    WorkerPool *pool;        // workers computing the tiles, NULL to compute inline
+    int64_t *worker_results; // private accumulators of every worker, NULL if rows do not overlap
+    double *worker_time;     // seconds every worker spent in the kernel
+} SlaveJob;
+
+// One stripe of a block being received, shared with its tile handler
+typedef struct
+{
+    int fd;                // stream the stripe arrives on
+    BlockHeader h;         // header of the stripe
+    Matrix view;           // rows of the submatrix the stripe fills
+    int offset;            // first row of the stripe within the block
+    SlaveJob *job;
+    pthread_mutex_t *lock; // lets the stripes hand their tiles to the job one at a time
+    uint32_t bad_tiles;
+    int rc;                // as proto_recv_payload
+    TransferStats stats;
+    pthread_t tid;
+    int started;           // 1 once a thread receives the stripe
+} StripeRecv;
+
+// Function to run the kernel over rows [first, first + count) of the block on one worker
+// Kernels whose outputs are per row write straight into the result (workers get
+// disjoint rows); per-column kernels add into the worker's private accumulators
+static void compute_rows(void *ctx, int worker, int first, int count)
+{
+    SlaveJob *job = (SlaveJob *)ctx;
+    int64_t *out = job->worker_results ? job->worker_results + (size_t)worker * job->result_len : job->result;
+
+    struct timespec time_before, time_after;
+    clock_gettime(CLOCK_MONOTONIC, &time_before);
+    kernel_tile(job->kernel, job->submatrix->dtype, matrix_row(job->submatrix, first), first, count,
+                job->submatrix->cols, job->vec, out);
+    clock_gettime(CLOCK_MONOTONIC, &time_after);
+    job->worker_time[worker] += (time_after.tv_sec - time_before.tv_sec) +
+                                (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
+}
+
+// Tile handler, called as soon as a tile has arrived and been checked
+// The next tile keeps streaming into the socket buffer meanwhile
+static void consume_tile(void *ctx, int first_row, int rows, void *data, int crc_ok)
+{
+    SlaveJob *job = (SlaveJob *)ctx;
+
+    job->tiles++;
+    if (!crc_ok)
+    {
+        job->bad_tiles++;
+        return;
+    }
+    if (job->kernel == KERNEL_NONE)
+        return;
+
+    (void)data;
+
+    // Compute on the tile while it is still in cache; with a pool, the workers
+    // split it into cache-sized pieces while this thread receives the next tile
+    if (job->pool)
+    {
+        size_t row_bytes = matrix_block_bytes(job->submatrix, 1);
+        int grain = (row_bytes > 0 && row_bytes < WORKER_TILE_BYTES) ? (int)(WORKER_TILE_BYTES / row_bytes) : 1;
+        pool_submit(job->pool, compute_rows, job, first_row, rows, grain);
+    }
+    else
+    {
+        compute_rows(job, 0, first_row, rows);
+    }
+}
+
+// Tile handler of a stripe, which hands the tile on as rows of the whole block
+static void consume_stripe_tile(void *ctx, int first_row, int rows, void *data, int crc_ok)
+{
+    StripeRecv *s = (StripeRecv *)ctx;
+    pthread_mutex_lock(s->lock);
+    consume_tile(s->job, s->offset + first_row, rows, data, crc_ok);
+    pthread_mutex_unlock(s->lock);
+}
+
+// Thread function receiving one stripe into its rows of the block
+static void *stripe_thread(void *arg)
+{
+    StripeRecv *s = (StripeRecv *)arg;
+    s->rc = proto_recv_payload(s->fd, &s->h, &s->view, consume_stripe_tile, s, &s->bad_tiles, &s->stats);
+    return NULL;
+}
+
+// Function to set up stripe k of the block of h: the header the master sends
+// for it, and the rows of the submatrix it fills
+static void stripe_init(StripeRecv *s, const BlockHeader *h, int k, Matrix *submatrix, SlaveJob *job,
+                        pthread_mutex_t *lock)
+{
+    int first;
+    int rows = proto_stripe_rows((int)h->num_rows, (int)h->stripes, k, &first);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->h = *h;
+    s->h.start_row = h->start_row + (uint32_t)first;
+    s->h.num_rows = (uint32_t)rows;
+    s->h.count = (uint64_t)rows * h->num_cols;
+    s->h.chunk_rows = (h->chunk_rows < (uint32_t)rows) ? h->chunk_rows : (uint32_t)rows;
+    s->view = *submatrix;
+    s->view.rows = rows;
+    s->view.data = matrix_row(submatrix, first);
+    s->view.file_offset += (size_t)((unsigned char *)s->view.data - (unsigned char *)submatrix->data);
+    s->offset = first;
+    s->job = job;
+    s->lock = lock;
+}
+
+// Function to check that a stripe header got from a stream is the one expected for its stripe
+static int stripe_matches(const StripeRecv *s, const BlockHeader *got)
+{
+    const BlockHeader *want = &s->h;
+    return !s->started && got->n == want->n && got->dtype == want->dtype && got->byte_order == want->byte_order &&
+           got->encoding == want->encoding && got->start_row == want->start_row && got->num_rows == want->num_rows &&
+           got->col_start == want->col_start && got->num_cols == want->num_cols;
+}
+
+// Function to list the children of rank in a broadcast or reduce of size slaves
+// Returns the number of children
+static int peer_children(int chain, uint32_t rank, uint32_t size, uint32_t children[MAX_PEER_CHILDREN])
+{
+    int count = 0;
+    if (chain)
+    {
+        if (rank + 1 < size)
+            children[count++] = rank + 1;
+        return count;
+    }
+
+    // Binomial tree: rank r forwards to r + 2^k for every 2^k > r, in round order
+    uint64_t step = 1;
+    while (step <= rank)
+        step <<= 1;
+    for (; rank + step < size && count < MAX_PEER_CHILDREN; step <<= 1)
+        children[count++] = rank + (uint32_t)step;
+    return count;
+}
+
+// Function to get the parent of rank > 0: the previous slave of a chain, or
+// rank without its highest bit in a binomial tree
+static uint32_t peer_parent(int chain, uint32_t rank)
+{
+    if (chain)
+        return rank - 1;
+    uint32_t high = 1;
+    while (high * 2 <= rank)
+        high *= 2;
+    return rank - high;
+}
+
+// Function to find the slave of a rank, resolving its address on first use
+// Returns NULL if the config has no such slave
+static SlaveInfo *peer_info(Collective *c, uint32_t rank)
+{
+    if (rank >= (uint32_t)c->cluster->num_slaves)
+    {
+        fprintf(stderr, "Rank %u is not a slave of the config\n", rank);
+        return NULL;
+    }
+    SlaveInfo *peer = &c->cluster->slaves[rank];
+    if (peer->addr_len == 0 && cluster_resolve(peer) != 0)
+        return NULL;
+    return peer;
+}
+
+// Thread function sending the broadcast vector to one child
+static void *relay_thread(void *arg)
+{
+    RelayArgs *a = (RelayArgs *)arg;
+    int fd = cluster_connect(a->peer, 0);
+    if (fd < 0 || proto_send_relay(fd, a->vec, (int)a->len, a->kind, a->rank, a->size, NULL) != 0)
+        fprintf(stderr, "Relay to slave %u (%s:%d) failed\n", a->rank, a->peer->host, a->peer->port);
+    if (fd >= 0)
+        close(fd);
+    pthread_mutex_lock(&a->owner->lock);
+    if (--a->owner->relays == 0)
+        pthread_cond_signal(&a->owner->idle);
+    pthread_mutex_unlock(&a->owner->lock);
+    free(a->vec);
+    free(a);
+    return NULL;
+}
+
+// Function to forward the broadcast vector to the children of rank
+// Every child gets its own detached thread, so a child still busy with its
+// own connection never holds up this slave's block
+static void bcast_forward(Collective *c, const int *vec, uint32_t len, uint32_t kind, uint32_t rank, uint32_t size)
+{
+    uint32_t children[MAX_PEER_CHILDREN];
+    int count = peer_children(kind == PROTO_FLAG_BCAST_CHAIN, rank, size, children);
+    for (int i = 0; i < count; i++)
+    {
+        SlaveInfo *peer = peer_info(c, children[i]);
+        if (peer == NULL)
+            continue;
+
+        RelayArgs *a = (RelayArgs *)malloc(sizeof(RelayArgs));
+        int *copy = (int *)malloc(((size_t)len + 1) * sizeof(int));
+        pthread_t tid;
+        if (a == NULL || copy == NULL)
+        {
+            free(a);
+            free(copy);
+            continue;
+        }
+        memcpy(copy, vec, (size_t)len * sizeof(int));
+        *a = (RelayArgs){c, peer, copy, len, kind, children[i], size};
+        pthread_mutex_lock(&c->lock);
+        c->relays++;
+        pthread_mutex_unlock(&c->lock);
+        if (pthread_create(&tid, NULL, relay_thread, a) != 0)
+        {
+            pthread_mutex_lock(&c->lock);
+            c->relays--;
+            pthread_mutex_unlock(&c->lock);
+            free(copy);
+            free(a);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+// Function to take the broadcast vector of a relay whose header h has been read
+// It is forwarded to the children and kept until its block arrives
+// Returns 0 on success, -1 on error
+static int bcast_store(Collective *c, int fd, const BlockHeader *h, TransferStats *stats)
+{
+    int *vec = (int *)malloc(((size_t)h->vec_len + 1) * sizeof(int));
+    if (vec == NULL || proto_recv_vector(fd, h, vec, stats) != 0)
+    {
+        fprintf(stderr, "Receiving the broadcast vector failed\n");
+        free(vec);
+        return -1;
+    }
+    bcast_forward(c, vec, h->vec_len, h->flags & PROTO_FLAG_BCAST, h->rank, h->ranks);
+    free(c->vec);
+    c->vec = vec;
+    c->len = h->vec_len;
+    return 0;
+}
+
+// Function to add the partial of a child whose header h has been read to the sum
+// of the partials, which waits there for this slave's own results
+// Returns 0 on success, -1 on error
+static int reduce_store(Collective *c, int fd, const BlockHeader *h, TransferStats *stats)
+{
+    BlockReply r;
+    if (proto_recv_reply(fd, &r, stats) != 0)
+        return -1;
+
+    int64_t *part = (int64_t *)malloc(((size_t)r.result_count + 1) * sizeof(int64_t));
+    if (part == NULL || proto_recv_result(fd, &r, part, stats) != 0)
+    {
+        fprintf(stderr, "Receiving the partial of slave %u failed\n", h->rank);
+        free(part);
+        return -1;
+    }
+
+    // A child that misses results, or sends the wrong number of them, spoils the sum
+    if (r.status != PROTO_STATUS_OK || (c->sum != NULL && r.result_count != c->sum_len))
+    {
+        c->incomplete = 1;
+        free(part);
+    }
+    else if (c->sum == NULL)
+    {
+        c->sum = part;
+        c->sum_len = r.result_count;
+    }
+    else
+    {
+        kernel_accumulate((ElemType)(h->dtype - 1), c->sum, part, (int)r.result_count);
+        free(part);
+    }
+    c->partials++;
+    return 0;
+}
+
+// Function to keep an extra stream of the master whose announcement has been read
+// The caller closes fd, so a duplicate of it is kept
+// Returns 0 on success, -1 on error
+static int stream_store(Collective *c, int fd)
+{
+    if (c->num_streams == PROTO_MAX_STREAMS)
+    {
+        fprintf(stderr, "Too many extra streams, refusing one\n");
+        return -1;
+    }
+    int keep = dup(fd);
+    if (keep < 0)
+        return -1;
+    c->streams[c->num_streams++] = keep;
+    return 0;
+}
+
+// Function to close extra stream i, once the master has closed it or a block failed
+static void stream_drop(Collective *c, int i)
+{
+    close(c->streams[i]);
+    memmove(&c->streams[i], &c->streams[i + 1], (size_t)(c->num_streams - i - 1) * sizeof(int));
+    c->num_streams--;
+}
+
+// Function to take a relay, a partial or an extra stream whose header h has been read
+// Returns 0 on success, -1 on error
+static int peer_store(Collective *c, int fd, const BlockHeader *h, TransferStats *stats)
+{
+    if (h->flags & PROTO_FLAG_STREAM)
+        return stream_store(c, fd);
+    if (h->flags & PROTO_FLAG_RELAY)
+        return bcast_store(c, fd, h, stats);
+    return reduce_store(c, fd, h, stats);
+}
+
+// Function to take the next relay, partial or extra stream on the listening socket
+// Returns 0 on success, -1 on error or when none came within PEER_TIMEOUT_MS
+static int peer_accept(Collective *c, const char *waiting_for)
+{
+    struct pollfd pfd = {c->listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, PEER_TIMEOUT_MS) <= 0)
+    {
+        fprintf(stderr, "No %s within %d ms\n", waiting_for, PEER_TIMEOUT_MS);
+        return -1;
+    }
+    int fd = accept(c->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return -1;
+
+    TransferStats stats = {0};
+    BlockHeader h;
+    int rc = proto_recv_header(fd, &h, &stats);
+    if (rc == 0 && (h.flags & (PROTO_FLAG_RELAY | PROTO_FLAG_PARTIAL | PROTO_FLAG_STREAM)))
+    {
+        rc = peer_store(c, fd, &h, &stats);
+    }
+    else
+    {
+        fprintf(stderr, "Expected a %s, closing the connection\n", waiting_for);
+        rc = -1;
+    }
+    close(fd);
+    return rc;
+}
+
+// Function to get the slice of the broadcast vector the block of h needs
+// Rank 0 receives the whole vector with its block and starts the broadcast;
+// the others get it from their parent, unless it already came
+// Returns as proto_recv_vector
+static int bcast_vector(Collective *c, int fd, const BlockHeader *h, int *vec, TransferStats *stats)
+{
+    if (h->rank == 0)
+    {
+        BlockHeader whole = *h;
+        whole.vec_len = h->n;
+        int *full = (int *)malloc(((size_t)h->n + 1) * sizeof(int));
+        if (full == NULL)
+            return -1;
+        int rc = proto_recv_vector(fd, &whole, full, stats);
+        if (rc != 0)
+        {
+            free(full);
+            return rc;
+        }
+        bcast_forward(c, full, h->n, h->flags & PROTO_FLAG_BCAST, 0, h->ranks);
+        free(c->vec);
+        c->vec = full;
+        c->len = h->n;
+    }
+    while (c->vec == NULL)
+    {
+        if (peer_accept(c, "broadcast relay") != 0)
+            return -1;
+    }
+
+    int rc = 0;
+    if (c->len == h->n)
+    {
+        int start = kernel_vector_start((KernelKind)h->kernel, (int)h->start_row, (int)h->col_start);
+        memcpy(vec, c->vec + start, (size_t)h->vec_len * sizeof(int));
+    }
+    else
+    {
+        fprintf(stderr, "Broadcast vector has %u elements, not %u\n", c->len, h->n);
+        rc = -1;
+    }
+    free(c->vec); // one vector per block
+    c->vec = NULL;
+    return rc;
+}
+
+// Function to receive a block whose tiles are striped over several streams
+// Stripe 0 follows the vector on the block's connection; the others come over
+// extra streams, matched to their stripe by their header whatever the stream,
+// and are received side by side by a thread each, straight into their rows
+// Stripe 0 starts first, so it is not held up by the headers of the others
+// Returns as proto_recv_payload
+static int stripes_receive(Collective *c, int fd, const BlockHeader *h, Matrix *submatrix, SlaveJob *job,
+                           uint32_t *bad_tiles, TransferStats *stats)
+{
+    int count = (int)h->stripes;
+    StripeRecv stripes[PROTO_MAX_STREAMS];
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    for (int k = 0; k < count; k++)
+        stripe_init(&stripes[k], h, k, submatrix, job, &lock);
+
+    // Stripe 0 gets its thread before any extra header is read; without a
+    // thread to spare it is received here first, the master sending the
+    // other stripes alongside it so they wait in their streams
+    stripes[0].fd = fd;
+    stripes[0].started = (pthread_create(&stripes[0].tid, NULL, stripe_thread, &stripes[0]) == 0);
+    if (!stripes[0].started)
+        stripe_thread(&stripes[0]);
+
+    // Start a stripe as soon as its header shows up on an idle stream; streams
+    // the master closed since the last block are dropped, new ones accepted
+    int waiting = count - 1;
+    int rc = 0;
+    while (waiting > 0)
+    {
+        struct pollfd pfds[PROTO_MAX_STREAMS + 1];
+        int idx[PROTO_MAX_STREAMS + 1];
+        int n = 0;
+        for (int i = 0; i < c->num_streams; i++)
+        {
+            int busy = 0;
+            for (int k = 1; k < count; k++)
+                busy |= (stripes[k].started && stripes[k].fd == c->streams[i]);
+            if (!busy)
+            {
+                pfds[n] = (struct pollfd){c->streams[i], POLLIN, 0};
+                idx[n++] = i;
+            }
+        }
+        pfds[n] = (struct pollfd){c->listen_fd, POLLIN, 0};
+        if (poll(pfds, n + 1, PEER_TIMEOUT_MS) <= 0)
+        {
+            fprintf(stderr, "No stripe within %d ms\n", PEER_TIMEOUT_MS);
+            rc = -1;
+            break;
+        }
+
+        int e = 0;
+        while (e < n && pfds[e].revents == 0)
+            e++;
+        if (e == n) // nothing but a new connection
+        {
+            if (peer_accept(c, "extra stream") != 0)
+            {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+
+        BlockHeader sh;
+        int hrc = proto_recv_header(c->streams[idx[e]], &sh, stats);
+        if (hrc == PROTO_CLOSED)
+        {
+            stream_drop(c, idx[e]); // replaced by the master
+            continue;
+        }
+        StripeRecv *s = (hrc == 0 && (sh.flags & PROTO_FLAG_STRIPE) && sh.ranks == (uint32_t)count) ? &stripes[sh.rank] : NULL;
+        if (s == NULL || !stripe_matches(s, &sh))
+        {
+            fprintf(stderr, "Unexpected stripe on an extra stream for rows %u-%u\n", h->start_row,
+                    h->start_row + h->num_rows - 1);
+            rc = -1;
+            break;
+        }
+        s->h = sh;
+        s->fd = c->streams[idx[e]];
+        if (pthread_create(&s->tid, NULL, stripe_thread, s) != 0)
+        {
+            rc = -1;
+            break;
+        }
+        s->started = 1;
+        waiting--;
+    }
+
+    // A failed block stops the stripes still arriving, stripe 0 included when
+    // the others never all showed up
+    if (rc != 0 && stripes[0].started)
+        shutdown(fd, SHUT_RDWR);
+    *bad_tiles = 0;
+    for (int k = 0; k < count; k++)
+    {
+        StripeRecv *s = &stripes[k];
+        if (k > 0 && !s->started)
+        {
+            s->rc = -1;
+            continue;
+        }
+        if (k > 0 && stripes[0].rc == -1)
+            shutdown(s->fd, SHUT_RDWR);
+        if (s->started)
+            pthread_join(s->tid, NULL);
+        transfer_stats_add(stats, &s->stats);
+        *bad_tiles += s->bad_tiles;
+        if (s->rc == -1 || (s->rc == PROTO_ERR_CHECKSUM && rc == 0))
+            rc = s->rc;
+    }
+    return rc;
+}
+
+// Function to reduce the results of the block of h with those of the children
+// The block's results are spread over the whole output into sum, as the master's
+// gather would, and the children's partials added; rank 0 keeps the total for
+// its reply to the master, the others send it to their parent and reply without results
+// reply->status is set to PROTO_STATUS_INCOMPLETE when results are missing
+static void reduce_results(Collective *c, const BlockHeader *h, const int64_t *result, BlockReply *reply,
+                           KernelGather *sum)
+{
+    int chain = (h->flags & PROTO_FLAG_REDUCE) == PROTO_FLAG_REDUCE_CHAIN;
+    KernelKind kernel = (KernelKind)h->kernel;
+    ElemType dtype = (ElemType)(h->dtype - 1);
+    MatrixBlock blk = {(int)h->start_row, (int)h->num_rows, (int)h->col_start, (int)h->num_cols};
+    int len = kernel_result_len(kernel, (int)h->n, (int)h->n);
+    int complete = (reply->status == PROTO_STATUS_OK);
+
+    if (kernel_gather_init(sum, kernel, (int)h->n, dtype) != 0)
+    {
+        sum->acc = NULL;
+        complete = 0;
+    }
+    else if (complete)
+    {
+        kernel_gather_add(sum, &blk, result);
+    }
+
+    // Wait for every child, then fold their sum in
+    uint32_t children[MAX_PEER_CHILDREN];
+    int count = peer_children(chain, h->rank, h->ranks, children);
+    while (c->partials < count)
+    {
+        if (peer_accept(c, "partial from a child") != 0)
+            break;
+    }
+    if (c->partials < count || c->incomplete || (c->sum != NULL && c->sum_len != (uint32_t)len))
+        complete = 0;
+    else if (c->sum != NULL && sum->acc != NULL)
+        kernel_accumulate(dtype, sum->acc, c->sum, len);
+    free(c->sum); // one reduce per block
+    c->sum = NULL;
+    c->sum_len = 0;
+    c->partials = 0;
+    c->incomplete = 0;
+
+    if (!complete && reply->status == PROTO_STATUS_OK)
+        reply->status = PROTO_STATUS_INCOMPLETE;
+    reply->result_count = (reply->status == PROTO_STATUS_OK) ? (uint32_t)len : 0;
+    if (h->rank == 0)
+        return;
+
+    // Pass the sum on; the master only hears whether this slave's part went well
+    BlockReply partial = *reply;
+    SlaveInfo *parent = peer_info(c, peer_parent(chain, h->rank));
+    int fd = parent ? cluster_connect(parent, 0) : -1;
+    if (fd < 0 || proto_send_partial(fd, h->kernel, dtype, (int)h->n, h->flags & PROTO_FLAG_REDUCE, h->rank, h->ranks,
+                                     &partial, sum->acc, NULL) != 0)
+    {
+        fprintf(stderr, "Sending the partial to slave %u failed\n", peer_parent(chain, h->rank));
+        reply->status = PROTO_STATUS_INCOMPLETE;
+    }
+    if (fd >= 0)
+        close(fd);
+    reply->result_count = 0;
+}
+
+// Function to create the listening socket
+// Listens on IPv6 with IPv4-mapped addresses enabled, so masters can reach
+// the slave over either protocol; falls back to IPv4 only without IPv6
+static int slave_listen(int port)
+{
+    // Create socket
+    int family = AF_INET6;
+    int server_fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (server_fd < 0)
+    {
+        family = AF_INET;
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    if (server_fd < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    // Set socket options to reuse address
+    // SOL_SOCKET indicates that the option is at socket level
+    // SO_REUSEADDR allows the socket to bind to an address that is already in use
+    int opt = 1; // enabled for socket option
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    {
+        perror("Setsockopt failed");
+        close(server_fd);
+        return -1;
+    }
+
+    // The connections accepted on it inherit the socket profile
+    transfer_tune(server_fd);
+
+    // Bind socket to port
+    struct sockaddr_storage address;
+    socklen_t address_len;
+    memset(&address, 0, sizeof(address));
+    if (family == AF_INET6)
+    {
+        int v6only = 0; // accept IPv4 connections too
+        setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+        struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&address;
+        a6->sin6_family = AF_INET6;
+        a6->sin6_addr = in6addr_any;
+        a6->sin6_port = htons(port);
+        address_len = sizeof(*a6);
+    }
+    else
+    {
+        struct sockaddr_in *a4 = (struct sockaddr_in *)&address;
+        a4->sin_family = AF_INET;
+        a4->sin_addr.s_addr = INADDR_ANY;
+        a4->sin_port = htons(port);
+        address_len = sizeof(*a4);
+    }
+
+    if (bind(server_fd, (struct sockaddr *)&address, address_len) < 0)
+    {
+        perror("Bind failed");
+        close(server_fd);
+        return -1;
+    }
+
+    // Start listening; extra streams of the master queue up here until their block comes
+    if (listen(server_fd, SOMAXCONN) < 0)
+    {
+        perror("Listen failed");
+        close(server_fd);
+        return -1;
+    }
+
+    return server_fd;
+}
+
+// Function to receive and acknowledge one block on an accepted connection
+// A relay or partial from a peer slave, or an extra stream of the master, is taken instead, returning SLAVE_PEER
+// Returns 0 on success, PROTO_CLOSED if the master closed the connection, -1 on error
+static int slave_handle_block(int client_fd, const Options *opts, WorkerPool *pool, Collective *coll)
+{
+
+    // Wait for the next block so the time between jobs is not counted
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    poll(&pfd, 1, -1);
+
+    // Start timer
+    struct timespec time_before, time_after;
+    clock_gettime(CLOCK_MONOTONIC, &time_before);
+
+    TransferStats stats = {0};
+    BlockReply reply = {PROTO_STATUS_OK, 0, 0};
+
+    // Receive and validate the block header (matrix dimensions, row start and count)
+    BlockHeader header;
+    int rc = proto_recv_header(client_fd, &header, &stats);
+    if (rc != 0)
+    {
+        if (rc == PROTO_STATUS_BAD_HEADER)
+        {
+            reply.status = PROTO_STATUS_BAD_HEADER;
+            proto_send_reply(client_fd, &reply, NULL, &stats);
+        }
+        else if (rc != PROTO_CLOSED)
+        {
+            perror("Receiving header failed");
+        }
+        return (rc == PROTO_CLOSED) ? PROTO_CLOSED : -1;
+    }
+    if (header.flags & (PROTO_FLAG_RELAY | PROTO_FLAG_PARTIAL | PROTO_FLAG_STREAM))
+        return (peer_store(coll, client_fd, &header, &stats) == 0) ? SLAVE_PEER : -1;
+
+    int start_row = (int)header.start_row;
+    int num_rows = (int)header.num_rows;
+    int col_start = (int)header.col_start;
+    int num_cols = (int)header.num_cols;
+    int probe = (header.flags & PROTO_FLAG_PROBE) != 0;
+    int seeded = (header.flags & PROTO_FLAG_SEEDED) != 0;
+    KernelKind kernel = (KernelKind)header.kernel;
+
+    // The kernel must be known and come with the vector it needs
+    if (header.kernel > KERNEL_PEARSON || (int)header.vec_len != kernel_vector_len(kernel, num_rows, num_cols))
+    {
+        fprintf(stderr, "Bad header: kernel %u with a vector of %u elements\n", header.kernel, header.vec_len);
+        reply.status = PROTO_STATUS_BAD_HEADER;
+        proto_send_reply(client_fd, &reply, NULL, &stats);
+        return -1;
+    }
+
+    // printf("Receiving submatrix: n=%u, start_row=%d, num_rows=%d\n", header.n, start_row, num_rows);
+
+    // Allocate memory for submatrix and stream the block into it tile by tile
+    // With an output directory the block is received straight into a mapped
+    // matrix file, which keeps it past the job without holding it in memory
+    Matrix submatrix;
+    char out_path[320] = "";
+    if (opts->output_dir[0] != '\0' && !probe)
+    {
+        MatrixFileInfo file;
+        file.rows = num_rows;
+        file.cols = num_cols;
+        file.dtype = (ElemType)(header.dtype - 1);
+        file.row_start = start_row;
+        file.col_start = col_start;
+        file.seed = seeded ? header.seed : MATRIX_SEED_NONE;
+        snprintf(out_path, sizeof(out_path), "%s/block_r%d_c%d.mat", opts->output_dir, start_row, col_start);
+        if (matrix_create_file(&submatrix, out_path, &file) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (matrix_alloc(&submatrix, num_rows, num_cols, (ElemType)(header.dtype - 1)) != 0)
+    {
+        return -1;
+    }
+
+    // The vector arrives first, then every tile is computed on as soon as it is in
+    int result_len = kernel_result_len(kernel, num_rows, num_cols);
+    int num_workers = pool ? pool->num_workers : 1;
+    int private_results = pool && (kernel == KERNEL_COLSUM || kernel == KERNEL_PEARSON);
+    int *vec = (int *)malloc(((size_t)header.vec_len + 1) * sizeof(int));
+    int64_t *result = (int64_t *)calloc((size_t)result_len + 1, sizeof(int64_t));
+    int64_t *worker_results = private_results ? (int64_t *)calloc((size_t)num_workers * result_len + 1, sizeof(int64_t)) : NULL;
+    double *worker_time = (double *)calloc(num_workers, sizeof(double));
+    if (vec == NULL || result == NULL || (private_results && worker_results == NULL) || worker_time == NULL)
+    {
+        perror("Result allocation failed");
+        free(vec);
+        free(result);
+        free(worker_results);
+        free(worker_time);
+        matrix_free(&submatrix);
+        return -1;
+    }
+
+    SlaveJob job = {&submatrix, 0, 0, kernel, vec, result, result_len, pool, worker_results, worker_time};
+    int vec_rc = ((header.flags & PROTO_FLAG_BCAST) && header.vec_len > 0)
+                     ? bcast_vector(coll, client_fd, &header, vec, &stats)
+                     : proto_recv_vector(client_fd, &header, vec, &stats);
+    if (vec_rc == PROTO_ERR_CHECKSUM)
+        job.kernel = KERNEL_NONE; // still drain the tiles, but nothing to compute with
+    if (vec_rc == -1)
+    {
+        rc = -1;
+    }
+    else if (seeded)
+    {
+        // Regenerate the block tile by tile, so the workers compute on a tile
+        // while the next one is generated, as they would while it arrives
+        MatrixBlock blk = {start_row, num_rows, col_start, num_cols};
+        int tile = (int)header.chunk_rows;
+        for (int r = 0; r < num_rows; r += tile)
+        {
+            int rows = (num_rows - r < tile) ? num_rows - r : tile;
+            matrix_fill_seeded_block(&submatrix, header.seed, (int)header.n, &blk, r, rows);
+            consume_tile(&job, r, rows, matrix_row(&submatrix, r), 1);
+        }
+        rc = 0;
+    }
+    else if (header.stripes > 1)
+    {
+        rc = stripes_receive(coll, client_fd, &header, &submatrix, &job, &reply.bad_tiles, &stats);
+    }
+    else
+    {
+        rc = proto_recv_payload(client_fd, &header, &submatrix, consume_tile, &job, &reply.bad_tiles, &stats);
+    }
+
+    // Let the workers finish the last tiles, then fold their private accumulators
+    double compute_time = 0;
+    if (pool)
+        pool_wait(pool);
+    for (int w = 0; w < num_workers; w++)
+    {
+        if (worker_results)
+            kernel_accumulate(submatrix.dtype, result, worker_results + (size_t)w * result_len, result_len);
+        if (worker_time[w] > compute_time)
+            compute_time = worker_time[w];
+    }
+    free(worker_results);
+    free(worker_time);
+
+    if (rc == -1)
+    {
+        perror("Receiving submatrix failed");
+        free(vec);
+        free(result);
+        matrix_free(&submatrix);
+        return -1;
+    }
+    if (rc == PROTO_ERR_CHECKSUM || vec_rc == PROTO_ERR_CHECKSUM)
+    {
+        fprintf(stderr, "Checksum mismatch in %d of %d tiles of rows %d-%d%s\n",
+                job.bad_tiles, job.tiles, start_row, start_row + num_rows - 1,
+                vec_rc == PROTO_ERR_CHECKSUM ? " and in the vector" : "");
+        reply.status = PROTO_STATUS_CHECKSUM;
+    }
+
+    // Only complete, verified blocks send their results back
+    if (reply.status == PROTO_STATUS_OK)
+        reply.result_count = (uint32_t)result_len;
+
+    // A reduced block sends its results up the tree instead; rank 0 answers
+    // for all of them with the whole output
+    KernelGather sum = {0};
+    if (header.flags & PROTO_FLAG_REDUCE)
+    {
+        reduce_results(coll, &header, result, &reply, &sum);
+        if (header.rank == 0)
+        {
+            free(result);
+            result = sum.acc;
+            sum.acc = NULL;
+        }
+        kernel_gather_free(&sum);
+    }
+
+    // Print a small portion of the submatrix for verification (if matrix is large)
+    // printf("Received submatrix (showing up to 5x5):\n");
+    // for (int i = 0; i < (num_rows < 5 ? num_rows : 5); i++)
+    // {
+    //     for (int j = 0; j < (num_cols < 5 ? num_cols : 5); j++)
+    //     {
+    //         printf("%d ", matrix_row(&submatrix, i)[j]);
+    //     }
+    //     printf("...\n");
+    // }
+
+    // Send acknowledgment and results
+    if (proto_send_reply(client_fd, &reply, result, &stats) != 0)
+    {
+        perror("Sending acknowledgment failed");
+    }
+
+    // End timer
+    clock_gettime(CLOCK_MONOTONIC, &time_after);
+    double elapsed_time = (time_after.tv_sec - time_before.tv_sec) +
+                          (time_after.tv_nsec - time_before.tv_nsec) / 1000000000.0;
+
+    // Capacity probes only exist to be timed by the master
+    if (!probe)
+    {
+        printf("\nSlave execution time: %0.9f seconds\n", elapsed_time);
+        printf("%s rows %d-%d, columns %d-%d in %d tiles of up to %u rows\n", seeded ? "Generated" : "Received",
+               start_row, start_row + num_rows - 1, col_start, col_start + num_cols - 1,
+               job.tiles, header.chunk_rows);
+        if (header.stripes > 1 && !seeded)
+            printf("Tiles striped over %u streams\n", header.stripes);
+        if (kernel != KERNEL_NONE)
+            printf("Compute time (%s, %s, %s, %d threads): %0.9f seconds\n", kernel_name(kernel), dtype_name(submatrix.dtype),
+                   kernel_isa(), num_workers, compute_time);
+        if (out_path[0] != '\0')
+            printf("Block written to %s\n", out_path);
+        transfer_stats_print("Slave transfer", &stats);
+    }
+
+    // Clean up
+    free(vec);
+    free(result);
+    matrix_free(&submatrix);
+    return 0;
+}
+
+// Function to serve blocks on one connection until the master closes it
+// Returns SLAVE_PEER if the connection was a relay, a partial or an extra stream
+static int slave_serve_connection(int client_fd, const Options *opts, WorkerPool *pool, Collective *coll)
+{
+    int rc;
+    do
+    {
+        rc = slave_handle_block(client_fd, opts, pool, coll);
+    } while (rc == 0);
+
+    // The extra streams may still hold stripes of the failed block; the master reopens them
+    while (rc == -1 && coll->num_streams > 0)
+        stream_drop(coll, 0);
+
+    if (rc == SLAVE_PEER)
+        return rc;
+    return (rc == PROTO_CLOSED) ? 0 : -1;
+}
+
+// Function to run as slave
+int run_as_slave(int port, const char *master_ip, const Options *opts, Cluster *cluster)
+{
+    (void)master_ip; // the master connects to us, its address is only informative
+    // printf("Running as slave with port=%d, master=%s\n", port, master_ip);
+
+    int server_fd = slave_listen(port);
+    if (server_fd < 0)
+    {
+        return -1;
+    }
+
+    // Pick the kernels for this CPU once, before any block arrives
+    kernel_select(opts->simd);
+
+    // Every slave of this host takes its own run of slave_threads CPUs of the
+    // placement; the receiving thread shares the first one with worker 0
+    int *plan;
+    int num_cpus = affinity_plan(opts, &plan);
+    int base = (opts->cpu_slot > 0 ? opts->cpu_slot : 0) * opts->slave_threads;
+    affinity_pin(plan, num_cpus, base);
+
+    // Worker threads for the kernels, each pinned to its own core
+    WorkerPool workers;
+    WorkerPool *pool = NULL;
+    if (opts->slave_threads > 1)
+    {
+        int *cpus = NULL;
+        if (num_cpus > 0)
+        {
+            cpus = (int *)malloc(opts->slave_threads * sizeof(int));
+            for (int w = 0; w < opts->slave_threads; w++)
+            {
+                cpus[w] = plan[(base + w) % num_cpus];
+            }
+        }
+        if (pool_start(&workers, opts->slave_threads, cpus) == 0)
+            pool = &workers;
+        free(cpus);
+    }
+    free(plan);
+
+    // printf("Slave listening on port %d...\n", port);
+    Collective coll = {server_fd, cluster, NULL, 0, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, {0}, 0};
+
+    // Accept incoming connections; a persistent slave keeps accepting
+    // until it is killed, otherwise it exits after the first connection
+    // from the master (relays from peer slaves and extra streams do not count)
+    int rc = 0;
+    do
+    {
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
+        if (client_fd < 0)
+        {
+            perror("Accept failed");
+            rc = -1;
+            continue;
+        }
+
+        char client_ip[NI_MAXHOST], client_port[NI_MAXSERV];
+        getnameinfo((struct sockaddr *)&client_addr, client_addr_len, client_ip, sizeof(client_ip),
+                    client_port, sizeof(client_port), NI_NUMERICHOST | NI_NUMERICSERV);
+        // printf("Connection accepted from %s:%s\n", client_ip, client_port);
+
+        rc = slave_serve_connection(client_fd, opts, pool, &coll);
+        close(client_fd);
+        fflush(stdout);
+    } while (opts->persistent || rc == SLAVE_PEER);
+
+    // Let the relays to the children finish before exiting
+    pthread_mutex_lock(&coll.lock);
+    while (coll.relays > 0)
+        pthread_cond_wait(&coll.idle, &coll.lock);
+    pthread_mutex_unlock(&coll.lock);
+
+    close(server_fd);
+    while (coll.num_streams > 0)
+        stream_drop(&coll, 0);
+    free(coll.vec);
+    free(coll.sum);
+    if (pool)
+        pool_stop(pool);
+
+    return rc;
+}
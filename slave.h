@@ -0,0 +1,15 @@
+#ifndef SLAVE_H
+#define SLAVE_H
+
+#include "options.h"
+#include "cluster.h"
+
+// Function to run as slave
+// Listens on port, receives row blocks from the master, checks them tile
+// by tile as they stream in and replies with the result
+// Serves every job the master sends over its connection; with
+// opts->persistent it keeps accepting new connections until killed
+// cluster lists the slaves in the master's order, the peers a broadcast vector is forwarded to
+int run_as_slave(int port, const char *master_ip, const Options *opts, Cluster *cluster);
+
+#endif
@@ -10,20 +10,12 @@ T_VALUES=(2 4 8 16)
 
 # Compile both versions
 echo "Compiling programs..."
-gcc -Wall -Wextra -pthread -o lab04 lab04.c
-gcc -Wall -Wextra -pthread -o lab04_core_affine lab04_core_affine.c
+make
+
+# Write config.txt with the master and the first t slaves
+write_config() {
+    local t=$1
 
-# Function to run a single test
-run_test() {
-    local program=$1
-    local n=$2
-    local t=$3
-    local run_num=$4
-    
-    echo "n=$n, t=$t, run #$run_num"
-    # echo "Running $program with n=$n, t=$t, run #$run_num"
-    
-    # Update config to have correct number of slaves
     cat > config.txt << EOF
 # Auto-generated config for testing
 127.0.0.1 8000 master
@@ -33,29 +25,58 @@ EOF
     for ((i=1; i<=t; i++)); do
         echo "127.0.0.1 $((8000+i)) slave" >> config.txt
     done
-    
-    # Start slaves in background
+}
+
+# Start one persistent slave per port, once for the whole test session
+# The slaves keep serving jobs, so no respawn or startup wait is needed between runs
+start_slaves() {
+    local program=$1
+    local max_t=0
+    for t in "${T_VALUES[@]}"; do
+        if [ $t -gt $max_t ]; then max_t=$t; fi
+    done
+
+    # The slaves read the master's address from config.txt
+    write_config $max_t
+
     # $! is the PID of the last background process; these are stored in the slave_pids array.
-    for ((i=1; i<=t; i++)); do
-        ./$program $n $((8000+i)) 1 &
+    slave_pids=()
+    for ((i=1; i<=max_t; i++)); do
+        ./$program 0 $((8000+i)) 1 --persistent 1 &
         slave_pids+=($!)
     done
-    
+
     # Wait a moment for slaves to start
     sleep 2
-    
-    # Run master and capture timing
-    ./$program $n 8000 0
-    
-    # Kill slaves
+}
+
+# Kill the persistent slaves
+stop_slaves() {
     for pid in "${slave_pids[@]}"; do
         kill $pid 2>/dev/null
     done
-    
+
     # Clean up zombie processes
     wait
 }
 
+# Function to run a single test
+run_test() {
+    local program=$1
+    local n=$2
+    local t=$3
+    local run_num=$4
+    
+    echo "n=$n, t=$t, run #$run_num"
+    # echo "Running $program with n=$n, t=$t, run #$run_num"
+    
+    # Update config to have correct number of slaves
+    write_config $t
+    
+    # Run master and capture timing (the first t persistent slaves serve it)
+    ./$program $n 8000 0
+}
+
 # Main test loop
 echo "Starting tests..."
 echo "Results will be written to test_results.txt"
@@ -64,6 +85,8 @@ echo > test_results.txt
 echo "Test Results - $(date)" >> test_results.txt
 echo "================================" >> test_results.txt
 
+start_slaves "lab04" >> test_results.txt 2>&1
+
 for n in "${N_VALUES[@]}"; do
     for t in "${T_VALUES[@]}"; do
         echo "" >> test_results.txt
@@ -74,7 +97,6 @@ for n in "${N_VALUES[@]}"; do
         # Run regular version 3 times
         for run in 1; do
             echo "Run $run:" >> test_results.txt
-            slave_pids=()
             run_test "lab04" $n $t $run >> test_results.txt 2>&1
         done
         
@@ -84,11 +106,12 @@ for n in "${N_VALUES[@]}"; do
         # # Run core-affine version 3 times
         # for run in 1; do
         #     echo "Run $run:" >> test_results.txt
-        #     slave_pids=() # resets the slave_pids array 
         #     run_test "lab04_core_affine" $n $t $run >> test_results.txt 2>&1
         #     # So, 2>&1 tells the shell to redirect all error output (stderr) to the same place as standard output (stdout).
         # done
     done
 done
 
+stop_slaves
+
 echo "Testing complete! Check test_results.txt for detailed results."
\ No newline at end of file
@@ -116,8 +116,7 @@ done
 
 # Compile programs
 echo "Compiling programs..." | tee -a swarm_test_results.txt
-gcc -Wall -Wextra -pthread -o lab04 lab04.c
-gcc -Wall -Wextra -pthread -o lab04_core_affine lab04_core_affine.c
+make
 
 # Run tests
 for n in "${N_VALUES[@]}"; do
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include "topology.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+// Function to read one integer from a sysfs file
+// Returns the value, or fallback when the file is missing
+static int read_sysfs_int(const char *path, int fallback)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return fallback;
+    int v;
+    if (fscanf(fp, "%d", &v) != 1)
+        v = fallback;
+    fclose(fp);
+    return v;
+}
+
+// Function to count the CPUs below cpu in a cpulist file ("0-3,8-11")
+static int count_below(const char *path, int cpu)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+
+    char list[1024];
+    int below = 0;
+    if (fgets(list, sizeof(list), fp))
+    {
+        char *save = NULL;
+        for (char *tok = strtok_r(list, ",\n", &save); tok != NULL; tok = strtok_r(NULL, ",\n", &save))
+        {
+            int lo, hi;
+            int fields = sscanf(tok, "%d-%d", &lo, &hi);
+            if (fields < 1)
+                continue;
+            if (fields == 1)
+                hi = lo;
+            for (int c = lo; c <= hi && c < cpu; c++)
+                below++;
+        }
+    }
+    fclose(fp);
+    return below;
+}
+
+// Function to find the NUMA node of a CPU from its nodeN entry
+static int cpu_node(int cpu)
+{
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    int node = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL)
+    {
+        if (strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name + 4, "%d", &node) == 1)
+            break;
+    }
+    closedir(dir);
+    return node;
+}
+
+// Orders CPUs by node, package, core, then SMT sibling
+static int cmp_compact(const void *a, const void *b)
+{
+    const CpuInfo *x = (const CpuInfo *)a, *y = (const CpuInfo *)b;
+    if (x->node != y->node)
+        return x->node - y->node;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    return x->cpu - y->cpu;
+}
+
+// Orders CPUs by SMT sibling, then core position, alternating between nodes
+static int cmp_scatter(const void *a, const void *b)
+{
+    const CpuInfo *x = (const CpuInfo *)a, *y = (const CpuInfo *)b;
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    if (x->core_rank != y->core_rank)
+        return x->core_rank - y->core_rank;
+    if (x->node != y->node)
+        return x->node - y->node;
+    return x->cpu - y->cpu;
+}
+
+// Orders CPUs by CPU number
+static int cmp_cpu(const void *a, const void *b)
+{
+    return ((const CpuInfo *)a)->cpu - ((const CpuInfo *)b)->cpu;
+}
+
+// Function to read the topology of the allowed CPUs
+int topology_load(Topology *t)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        perror("sched_getaffinity failed");
+        return -1;
+    }
+
+    t->num_cpus = CPU_COUNT(&allowed);
+    t->num_nodes = 1;
+    t->cpus = (CpuInfo *)malloc((t->num_cpus > 0 ? t->num_cpus : 1) * sizeof(CpuInfo));
+    if (t->cpus == NULL)
+    {
+        perror("Topology allocation failed");
+        return -1;
+    }
+
+    int k = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && k < t->num_cpus; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        char path[160];
+        CpuInfo *c = &t->cpus[k++];
+        c->cpu = cpu;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        c->package = read_sysfs_int(path, 0);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+        c->core = read_sysfs_int(path, cpu);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+        c->smt = count_below(path, cpu);
+        c->node = cpu_node(cpu);
+        if (c->node + 1 > t->num_nodes)
+            t->num_nodes = c->node + 1;
+    }
+    t->num_cpus = k;
+
+    // Number the cores of every node in compact order
+    qsort(t->cpus, t->num_cpus, sizeof(CpuInfo), cmp_compact);
+    int rank = -1;
+    for (int i = 0; i < t->num_cpus; i++)
+    {
+        const CpuInfo *prev = (i > 0) ? &t->cpus[i - 1] : NULL;
+        if (prev == NULL || prev->node != t->cpus[i].node)
+            rank = 0;
+        else if (prev->package != t->cpus[i].package || prev->core != t->cpus[i].core)
+            rank++;
+        t->cpus[i].core_rank = rank;
+    }
+    qsort(t->cpus, t->num_cpus, sizeof(CpuInfo), cmp_cpu);
+    return 0;
+}
+
+// Function to release the CPU list
+void topology_free(Topology *t)
+{
+    free(t->cpus);
+    t->cpus = NULL;
+    t->num_cpus = 0;
+}
+
+// Function to find the NUMA node of a network interface
+int topology_nic_node(const char *nic, char *name, size_t name_len)
+{
+    snprintf(name, name_len, "%s", nic);
+
+    // No interface given: take the one of the default route
+    if (name[0] == '\0')
+    {
+        FILE *fp = fopen("/proc/net/route", "r");
+        if (fp != NULL)
+        {
+            char line[256], iface[64];
+            unsigned long dest, gateway, flags, refcnt, use, metric, mask;
+            while (fgets(line, sizeof(line), fp))
+            {
+                if (sscanf(line, "%63s %lx %lx %lx %lu %lu %lu %lx", iface, &dest, &gateway, &flags,
+                           &refcnt, &use, &metric, &mask) == 8 &&
+                    dest == 0 && mask == 0)
+                {
+                    snprintf(name, name_len, "%s", iface);
+                    break;
+                }
+            }
+            fclose(fp);
+        }
+    }
+    if (name[0] == '\0')
+        return -1;
+
+    char path[160];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+    int node = read_sysfs_int(path, -1);
+    return (node >= 0) ? node : -1;
+}
+
+// Node of the NIC for cmp_nic, qsort has no context argument
+static int nic_sort_node;
+
+// Orders the CPUs of the NIC's node first, each group in compact order
+static int cmp_nic(const void *a, const void *b)
+{
+    const CpuInfo *x = (const CpuInfo *)a, *y = (const CpuInfo *)b;
+    int xr = (x->node != nic_sort_node), yr = (y->node != nic_sort_node);
+    if (xr != yr)
+        return xr - yr;
+    return cmp_compact(a, b);
+}
+
+// Function to order the CPUs for a placement policy
+void topology_order(const Topology *t, AffinityPolicy policy, int nic_node, int *order)
+{
+    CpuInfo *sorted = (CpuInfo *)malloc((t->num_cpus > 0 ? t->num_cpus : 1) * sizeof(CpuInfo));
+    memcpy(sorted, t->cpus, t->num_cpus * sizeof(CpuInfo));
+
+    if (policy == AFFINITY_SCATTER)
+    {
+        qsort(sorted, t->num_cpus, sizeof(CpuInfo), cmp_scatter);
+    }
+    else if (policy == AFFINITY_NIC && nic_node >= 0)
+    {
+        nic_sort_node = nic_node;
+        qsort(sorted, t->num_cpus, sizeof(CpuInfo), cmp_nic);
+    }
+    else // compact, or nic with the card's node unknown
+    {
+        qsort(sorted, t->num_cpus, sizeof(CpuInfo), cmp_compact);
+    }
+
+    for (int i = 0; i < t->num_cpus; i++)
+        order[i] = sorted[i].cpu;
+    free(sorted);
+}
+
+// Function to build the placement of the run options
+int affinity_plan(const Options *opts, int **cpus)
+{
+    *cpus = NULL;
+    if (opts->affinity == AFFINITY_NONE)
+        return 0;
+
+    Topology t;
+    if (topology_load(&t) != 0)
+        return 0;
+
+    int count = 0;
+    char name[64];
+    int nic_node = (opts->affinity == AFFINITY_NIC) ? topology_nic_node(opts->nic, name, sizeof(name)) : -1;
+    *cpus = (int *)malloc((t.num_cpus > 0 ? t.num_cpus : 1) * sizeof(int));
+    if (*cpus != NULL)
+    {
+        topology_order(&t, opts->affinity, nic_node, *cpus);
+        count = t.num_cpus;
+    }
+    topology_free(&t);
+    return count;
+}
+
+// Function to pin the calling thread to one CPU of a placement
+void affinity_pin(const int *cpus, int count, int idx)
+{
+    if (count <= 0)
+        return;
+    cpu_set_t cpuset;                                                   // A set of CPUs the thread may run on
+    CPU_ZERO(&cpuset);                                                  // initialize the CPU set empty, clearing any previous CPU assignments
+    CPU_SET(cpus[idx % count], &cpuset);                                // Assign thread to its CPU of the placement
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset); // binds the thread to the CPU set
+}
+
+// Function to print a placement
+void affinity_print(const Options *opts, const int *cpus, int count)
+{
+    static const char *const names[] = {"none", "compact", "scatter", "nic"};
+    if (count == 0)
+    {
+        printf("Affinity %s: threads not pinned\n", names[opts->affinity]);
+        return;
+    }
+
+    printf("Affinity %s", names[opts->affinity]);
+    if (opts->affinity == AFFINITY_NIC)
+    {
+        char name[64];
+        int node = topology_nic_node(opts->nic, name, sizeof(name));
+        if (node >= 0)
+            printf(" (%s on node %d)", name, node);
+        else
+            printf(" (%s node unknown, compact)", name[0] ? name : "no NIC");
+    }
+    printf(": cpus");
+    for (int i = 0; i < count; i++)
+        printf("%s%d", i ? "," : " ", cpus[i]);
+    printf("\n");
+}
@@ -0,0 +1,62 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include "options.h"
+
+// CPU topology of this host and the thread placements derived from it
+//
+// Only the CPUs this process may run on (sched_getaffinity) are listed;
+// cores, SMT siblings and NUMA nodes come from sysfs, and default to one
+// thread per core on a single node when sysfs does not expose them
+// A placement is an ordered list of CPUs: thread i runs on cpus[i % count]
+//   compact : SMT siblings of a core, then the next core of the same node
+//   scatter : one thread per physical core, alternating between nodes,
+//             before any core gets a second thread
+//   nic     : compact over the node of the network card first, then the others
+
+// One logical CPU
+typedef struct
+{
+    int cpu;       // logical CPU number
+    int package;   // physical package (socket)
+    int core;      // core id within the package
+    int smt;       // position among the SMT siblings of its core, 0 = first thread
+    int node;      // NUMA node
+    int core_rank; // position of its core among the cores of its node
+} CpuInfo;
+
+typedef struct
+{
+    CpuInfo *cpus; // allowed CPUs, in CPU number order
+    int num_cpus;
+    int num_nodes;
+} Topology;
+
+// Function to read the topology of the CPUs this process may run on
+// Returns 0 on success, -1 on error
+int topology_load(Topology *t);
+
+// Releases the CPU list
+void topology_free(Topology *t);
+
+// Function to find the NUMA node of a network interface
+// An empty nic means the interface of the default route; its name is copied to name
+// Returns the node, or -1 when unknown
+int topology_nic_node(const char *nic, char *name, size_t name_len);
+
+// Function to order the CPUs for a placement policy
+// order receives t->num_cpus CPU numbers
+void topology_order(const Topology *t, AffinityPolicy policy, int nic_node, int *order);
+
+// Function to build the placement of the run options
+// *cpus is malloc'ed; returns the number of CPUs, 0 when threads are not pinned
+int affinity_plan(const Options *opts, int **cpus);
+
+// Function to pin the calling thread to cpus[idx % count]; does nothing when count is 0
+void affinity_pin(const int *cpus, int count, int idx);
+
+// Function to print a placement
+void affinity_print(const Options *opts, const int *cpus, int count);
+
+#endif
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "transfer.h"
+
+// Socket profile of the process, TCP_NODELAY only by default
+static SocketProfile profile = {0, 0, 1, 0, 0, 0};
+
+// Function to wait until the socket is ready again after EAGAIN
+static void wait_ready(int fd, short events)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    poll(&pfd, 1, -1);
+}
+
+// Function to send a whole buffer
+int send_all(int fd, const void *buf, size_t len, TransferStats *stats)
+{
+    const char *p = (const char *)buf;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t k = send(fd, p + done, len - done, MSG_NOSIGNAL);
+        if (stats)
+            stats->send_calls++;
+
+        if (k < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (stats)
+                    stats->stalls++;
+                if (errno != EINTR)
+                    wait_ready(fd, POLLOUT);
+                continue;
+            }
+            return -1;
+        }
+
+        done += (size_t)k;
+        if (stats)
+            stats->bytes_sent += (size_t)k;
+    }
+
+    return 0;
+}
+
+// Function to receive a whole buffer
+int recv_all(int fd, void *buf, size_t len, TransferStats *stats)
+{
+    char *p = (char *)buf;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t k = recv(fd, p + done, len - done, 0);
+        if (stats)
+            stats->recv_calls++;
+
+        if (k < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (stats)
+                    stats->stalls++;
+                if (errno != EINTR)
+                    wait_ready(fd, POLLIN);
+                continue;
+            }
+            return -1;
+        }
+        if (k == 0) // peer closed before the full buffer arrived
+        {
+            errno = ECONNRESET;
+            return (done == 0) ? 1 : -1; // 1: clean close between messages
+        }
+
+        done += (size_t)k;
+        if (stats)
+            stats->bytes_received += (size_t)k;
+    }
+
+    return 0;
+}
+
+// Function to send what the socket accepts without blocking
+long send_some(int fd, const void *buf, size_t len, TransferStats *stats)
+{
+    for (;;)
+    {
+        ssize_t k = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (stats)
+            stats->send_calls++;
+
+        if (k >= 0)
+        {
+            if (stats)
+                stats->bytes_sent += (size_t)k;
+            return (long)k;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (stats)
+                stats->stalls++;
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// Function to receive what the socket has without blocking
+long recv_some(int fd, void *buf, size_t len, TransferStats *stats)
+{
+    for (;;)
+    {
+        ssize_t k = recv(fd, buf, len, MSG_DONTWAIT);
+        if (stats)
+            stats->recv_calls++;
+
+        if (k > 0)
+        {
+            if (stats)
+                stats->bytes_received += (size_t)k;
+            return (long)k;
+        }
+        if (k == 0)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (stats)
+                stats->stalls++;
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// Function to ignore SIGPIPE, so a peer closing during sendfile fails the call with EPIPE
+static void ignore_sigpipe(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static pthread_once_t sigpipe_once = PTHREAD_ONCE_INIT;
+
+// Function to send a file range from the page cache
+int sendfile_all(int fd, int file_fd, off_t off, size_t len, TransferStats *stats)
+{
+    pthread_once(&sigpipe_once, ignore_sigpipe);
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t k = sendfile(fd, file_fd, &off, len - done);
+        if (stats)
+            stats->send_calls++;
+
+        if (k < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (stats)
+                    stats->stalls++;
+                if (errno != EINTR)
+                    wait_ready(fd, POLLOUT);
+                continue;
+            }
+            return -1;
+        }
+        if (k == 0) // the file is shorter than the range
+        {
+            errno = EIO;
+            return -1;
+        }
+
+        done += (size_t)k; // off was advanced by sendfile
+        if (stats)
+            stats->bytes_sent += (size_t)k;
+    }
+
+    return 0;
+}
+
+// Function to send what the socket accepts of a file range without blocking
+long sendfile_some(int fd, int file_fd, off_t off, size_t len, TransferStats *stats)
+{
+    pthread_once(&sigpipe_once, ignore_sigpipe);
+    for (;;)
+    {
+        ssize_t k = sendfile(fd, file_fd, &off, len);
+        if (stats)
+            stats->send_calls++;
+
+        if (k > 0)
+        {
+            if (stats)
+                stats->bytes_sent += (size_t)k;
+            return (long)k;
+        }
+        if (k == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (stats)
+                stats->stalls++;
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// Function to receive into a file range through a pipe
+int splice_all(int fd, const int pipe_fds[2], int file_fd, off_t off, size_t len, TransferStats *stats)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t k = splice(fd, NULL, pipe_fds[1], NULL, len - done, SPLICE_F_MOVE);
+        if (stats)
+            stats->recv_calls++;
+
+        if (k < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (stats)
+                    stats->stalls++;
+                if (errno != EINTR)
+                    wait_ready(fd, POLLIN);
+                continue;
+            }
+            return -1;
+        }
+        if (k == 0) // peer closed before the full range arrived
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (stats)
+            stats->bytes_received += (size_t)k;
+
+        // Drain the pipe into the file before taking more from the socket
+        for (ssize_t left = k; left > 0;)
+        {
+            ssize_t w = splice(pipe_fds[0], NULL, file_fd, &off, (size_t)left, SPLICE_F_MOVE);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return -1;
+            left -= w;
+        }
+        done += (size_t)k;
+    }
+
+    return 0;
+}
+
+// Function to print transfer counters
+void transfer_stats_print(const char *label, const TransferStats *stats)
+{
+    printf("%s: sent %zu bytes in %lu calls, received %zu bytes in %lu calls, %lu stalls",
+           label, stats->bytes_sent, stats->send_calls,
+           stats->bytes_received, stats->recv_calls, stats->stalls);
+    if (stats->zerocopy_calls > 0)
+        printf(", %lu zero-copy sends", stats->zerocopy_calls);
+    printf("\n");
+}
+
+// Function to add up the counters of two connections
+void transfer_stats_add(TransferStats *to, const TransferStats *from)
+{
+    if (to == NULL)
+        return;
+    to->bytes_sent += from->bytes_sent;
+    to->bytes_received += from->bytes_received;
+    to->send_calls += from->send_calls;
+    to->recv_calls += from->recv_calls;
+    to->stalls += from->stalls;
+    to->zerocopy_calls += from->zerocopy_calls;
+}
+
+// Function to set the socket profile of the process
+void transfer_set_profile(const SocketProfile *p)
+{
+    profile = *p;
+}
+
+// Function to get the socket profile of the process
+const SocketProfile *transfer_profile(void)
+{
+    return &profile;
+}
+
+// Function to set one socket option, reporting the first refusal of each option
+static void set_option(int fd, int level, int name, int value, const char *label, int *warned)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) != 0 && !*warned)
+    {
+        *warned = 1;
+        fprintf(stderr, "Cannot set %s: %s\n", label, strerror(errno));
+    }
+}
+
+// Function to apply the socket profile to a new socket
+void transfer_tune(int fd)
+{
+    static int warned[5]; // one warning per option and process
+    if (profile.sndbuf > 0)
+        set_option(fd, SOL_SOCKET, SO_SNDBUF, profile.sndbuf, "SO_SNDBUF", &warned[0]);
+    if (profile.rcvbuf > 0)
+        set_option(fd, SOL_SOCKET, SO_RCVBUF, profile.rcvbuf, "SO_RCVBUF", &warned[1]);
+    if (profile.nodelay)
+        set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY", &warned[2]);
+    if (profile.busy_poll > 0)
+        set_option(fd, SOL_SOCKET, SO_BUSY_POLL, profile.busy_poll, "SO_BUSY_POLL", &warned[3]);
+    if (profile.zerocopy)
+        set_option(fd, SOL_SOCKET, SO_ZEROCOPY, 1, "SO_ZEROCOPY", &warned[4]);
+}
+
+// Function to cork or uncork a socket around a block
+void transfer_cork(int fd, int on)
+{
+    if (profile.cork)
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+// Function to drop the zero-copy completions queued on a socket
+// They only say the pages are free again, and the matrix is never changed
+// while it is sent, so nothing waits for them; left queued they would use up
+// the socket's option memory and turn the next MSG_ZEROCOPY sends into errors
+void transfer_reap_zerocopy(int fd)
+{
+    char control[128];
+    for (;;)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+    }
+}
+
+// Function to send a whole buffer of stable data, with MSG_ZEROCOPY when the profile asks for it
+int send_all_stable(int fd, const void *buf, size_t len, TransferStats *stats)
+{
+    if (!profile.zerocopy || len < TRANSFER_ZEROCOPY_MIN)
+        return send_all(fd, buf, len, stats);
+
+    const char *p = (const char *)buf;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t k = send(fd, p + done, len - done, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        if (stats)
+            stats->send_calls++;
+
+        if (k < 0)
+        {
+            if (errno == ENOBUFS) // out of option memory for completions: copy this one
+            {
+                transfer_reap_zerocopy(fd);
+                return send_all(fd, p + done, len - done, stats);
+            }
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (stats)
+                    stats->stalls++;
+                if (errno != EINTR)
+                    wait_ready(fd, POLLOUT);
+                continue;
+            }
+            return -1;
+        }
+
+        done += (size_t)k;
+        if (stats)
+        {
+            stats->bytes_sent += (size_t)k;
+            stats->zerocopy_calls++;
+        }
+    }
+    transfer_reap_zerocopy(fd);
+    return 0;
+}
+
+// Function to get profile i of the sweep benchmark
+const char *transfer_sweep_profile(int i, const SocketProfile *configured, SocketProfile *out)
+{
+    static const struct
+    {
+        const char *name;
+        SocketProfile p;
+    } sweep[TRANSFER_SWEEP_PROFILES - 1] = {
+        {"kernel", {0, 0, 0, 0, 0, 0}},
+        {"nodelay", {0, 0, 1, 0, 0, 0}},
+        {"cork", {0, 0, 1, 1, 0, 0}},
+        {"buffers", {4 << 20, 4 << 20, 1, 0, 0, 0}},
+        {"busy-poll", {0, 0, 1, 0, 50, 0}},
+        {"zerocopy", {0, 0, 1, 0, 0, 1}},
+        {"all", {4 << 20, 4 << 20, 1, 1, 50, 1}},
+    };
+    if (i <= 0 || i >= TRANSFER_SWEEP_PROFILES)
+    {
+        *out = *configured;
+        return "config";
+    }
+    *out = sweep[i - 1].p;
+    return sweep[i - 1].name;
+}
+
+// Function to print the options of a profile
+void transfer_profile_print(const char *name, const SocketProfile *p)
+{
+    printf("Socket profile %s: sndbuf %d, rcvbuf %d, nodelay %d, cork %d, busy-poll %d us, zerocopy %d\n", name,
+           p->sndbuf, p->rcvbuf, p->nodelay, p->cork, p->busy_poll, p->zerocopy);
+}
+
+// Function to print the throughput of one profile of the sweep
+void transfer_sweep_print(const char *name, int jobs, size_t bytes, double seconds)
+{
+    printf("Sweep %-9s: %d jobs, %zu bytes in %0.9f seconds, %.1f MB/s\n", name, jobs, bytes, seconds,
+           seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
@@ -0,0 +1,105 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Per-connection transfer counters
+typedef struct
+{
+    size_t bytes_sent;          // total bytes handed to the kernel
+    size_t bytes_received;      // total bytes read from the kernel
+    unsigned long send_calls;   // number of send() syscalls
+    unsigned long recv_calls;   // number of recv() syscalls
+    unsigned long stalls;       // retries after EINTR / EAGAIN
+    unsigned long zerocopy_calls; // send() syscalls made with MSG_ZEROCOPY
+} TransferStats;
+
+// Socket options of the data connections, one profile per process
+// Applied to sockets as they are created (buffer sizes must be set before
+// connect or listen to take part in the window scale); a listening socket
+// passes them on to the connections it accepts
+typedef struct
+{
+    int sndbuf;    // SO_SNDBUF in bytes, 0 = kernel default (autotuned)
+    int rcvbuf;    // SO_RCVBUF in bytes, 0 = kernel default (autotuned)
+    int nodelay;   // 1 = TCP_NODELAY: headers and replies leave at once instead of waiting for an ACK
+    int cork;      // 1 = TCP_CORK around each block, so it leaves in full segments
+    int busy_poll; // SO_BUSY_POLL: microseconds a blocking receive spins on the device queue, 0 = off
+    int zerocopy;  // 1 = MSG_ZEROCOPY on sends of matrix data of at least TRANSFER_ZEROCOPY_MIN bytes
+} SocketProfile;
+
+#define TRANSFER_ZEROCOPY_MIN (64 * 1024) // smaller sends are cheaper to copy than to pin
+#define TRANSFER_SWEEP_PROFILES 8         // profiles compared by the sweep benchmark
+
+// Sends exactly len bytes, looping over short writes
+// Retries on EINTR and waits for the socket on EAGAIN
+// Returns 0 on success, -1 on error (errno is set)
+int send_all(int fd, const void *buf, size_t len, TransferStats *stats);
+
+// Receives exactly len bytes, looping over short reads
+// Retries on EINTR and waits for the socket on EAGAIN
+// Returns 0 on success, 1 if the peer closed the connection before sending
+// any byte of the buffer, -1 on error or if the peer closed midway (errno is set)
+int recv_all(int fd, void *buf, size_t len, TransferStats *stats);
+
+// Non-blocking variants for event-driven callers
+// Move as many bytes as the socket takes right now (retrying EINTR)
+// Return the number of bytes moved, 0 if the socket would block
+// (counted as a stall), -1 on error or, for recv_some, when the peer closed
+long send_some(int fd, const void *buf, size_t len, TransferStats *stats);
+long recv_some(int fd, void *buf, size_t len, TransferStats *stats);
+
+// Zero-copy variants for file-backed data, counted as send / recv calls
+// sendfile_all sends len bytes of file_fd from offset off, straight from the page cache
+// splice_all receives len bytes into file_fd at offset off, moving them through
+// pipe_fds (a pipe owned by the caller) without passing through user space
+// SIGPIPE is ignored once they are used, as sendfile has no MSG_NOSIGNAL
+// Return 0 on success, -1 on error or if the peer closed midway (errno is set)
+int sendfile_all(int fd, int file_fd, off_t off, size_t len, TransferStats *stats);
+int splice_all(int fd, const int pipe_fds[2], int file_fd, off_t off, size_t len, TransferStats *stats);
+
+// Non-blocking sendfile, returns as send_some does
+long sendfile_some(int fd, int file_fd, off_t off, size_t len, TransferStats *stats);
+
+// Prints the counters of one connection on a single line
+void transfer_stats_print(const char *label, const TransferStats *stats);
+
+// Adds the counters of from to to (to may be NULL)
+void transfer_stats_add(TransferStats *to, const TransferStats *from);
+
+// Sets the socket profile of the process; the sockets created afterwards use it
+void transfer_set_profile(const SocketProfile *p);
+
+// Returns the socket profile of the process
+const SocketProfile *transfer_profile(void);
+
+// Function to apply the socket profile to a new socket, before connect or listen
+// Options the kernel refuses are reported once and skipped
+void transfer_tune(int fd);
+
+// Corks (on = 1) or uncorks the socket around a block, when the profile asks for it
+void transfer_cork(int fd, int on);
+
+// send_all for data that stays unchanged until the run ends (the matrix), so it
+// may leave with MSG_ZEROCOPY: pages are pinned instead of copied, and the
+// completions queued on the socket are reaped as they come
+int send_all_stable(int fd, const void *buf, size_t len, TransferStats *stats);
+
+// Drops the zero-copy completions queued on a socket; until then it polls with POLLERR
+void transfer_reap_zerocopy(int fd);
+
+// Function to get profile i (0 .. TRANSFER_SWEEP_PROFILES - 1) of the sweep benchmark
+// Profile 0 is the configured one, the others each turn on one option (the
+// last all of them) over kernel defaults
+// Returns the name of the profile
+const char *transfer_sweep_profile(int i, const SocketProfile *configured, SocketProfile *out);
+
+// Prints the options of a profile on a single line
+void transfer_profile_print(const char *name, const SocketProfile *p);
+
+// Prints the throughput of one profile of the sweep: bytes sent over the
+// execution time of its jobs
+void transfer_sweep_print(const char *name, int jobs, size_t bytes, double seconds);
+
+#endif